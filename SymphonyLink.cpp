@@ -2,10 +2,28 @@
 #include "SymphonyLink.h"
 #include "ll_ifc_symphony.h"
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#endif
 
 
 modemState SymphonyLink::updateModemState(void)
 {
+	selectTransport();
+	accountPower();
+	
+	//Leave a sleeping module alone until there is a reason to wake it
+	if(_asleep)
+	{
+		if(!_wakeScheduled || (int32_t)(millis() - _wakeAt) < 0)
+		{
+			return _state;
+		}
+		wake();
+	}
+	
 	//clear all flags
 	getIRQ(0xFFFFFFFF);
 	
@@ -16,6 +34,9 @@ modemState SymphonyLink::updateModemState(void)
 		case INIT:
 			Serial.write("State: INIT\r");
 			
+			//radio settings may change with the new configuration
+			_radioValid = false;
+			
 			//configure module and start connection
 			if(0 > ll_config_set(_net_token, _app_token, _downlink_mode, _qos))
 			{
@@ -87,6 +108,7 @@ modemState SymphonyLink::updateModemState(void)
 			}
 			else if(_txState == LL_TX_STATE_TRANSMITTING)
 			{
+				_txStarted = millis();
 				_state = SENDING_FRAME;
 			}
 			break;
@@ -97,23 +119,52 @@ modemState SymphonyLink::updateModemState(void)
 			if ((_IRQ & IRQ_FLAGS_TX_DONE) != 0)
 			{
 				Serial.write("\nSent message!!!!!!\n");
-				//clear the flasg
-				getIRQ(IRQ_FLAGS_TX_ERROR);
+				txComplete(true);
 				_state = READ_TO_SEND;
 				
 			}
 			else if  ((_IRQ & IRQ_FLAGS_TX_ERROR) != 0)
 			{
 				Serial.write("\nError sending frame\n");
-				getIRQ(IRQ_FLAGS_TX_ERROR);
-
-				_state = SENDING_FRAME;
+				txFailed();
+				_state = READ_TO_SEND;
+			}
+			else if((millis() - _txStarted) >= SL_TX_TIMEOUT_MS)
+			{
+				Serial.write("\nFrame timed out\n");
+				txFailed();
+				_state = READ_TO_SEND;
 			}
 			break;
 
 		default:
 			while(1);
 	}
+	
+	if(_state == READ_TO_SEND)
+	{
+		if(_sequencing)
+		{
+			_sequencer.poll(millis(), SL_SEQ_GAP_TIMEOUT_MS);
+		}
+		serviceFragments();
+		serviceUplink();
+	}
+	
+	if((_state == READ_TO_SEND) || (_state == SENDING_FRAME))
+	{
+		sampleLink();
+		syncClock();
+		
+		if((_statsInterval != 0) &&
+		   (!_statsBaseline || ((millis() - _statsSampled) >= _statsInterval)))
+		{
+			sampleStats();
+		}
+	}
+	
+	managePower();
+	
 	return	_state;
 }
 
@@ -127,11 +178,77 @@ SymphonyLink::SymphonyLink()
 	_qos = 0;
 	_state = INIT;
 	
+	_powerMode = POWER_ALWAYS_ON;
+	_asleep = false;
+	_sleepBlocked = false;
+	_wakeScheduled = false;
+	_wakeAt = 0;
+	_powerTick = millis();
+	_sleepCurrent = SL_SLEEP_CURRENT_UA;
+	_idleCurrent = SL_IDLE_CURRENT_UA;
+	_txCurrent = SL_TX_CURRENT_UA;
+	_charge = 0;
+	
+	memset(_gateways, 0, sizeof(_gateways));
+	_gateway = -1;
+	_gatewayChannel = 0;
+	_scanning = false;
+	_linkDegraded = false;
+	_lastRssi = 0;
+	_linkInterval = SL_LINK_SAMPLE_INTERVAL_MS;
+	_linkSampled = 0;
+	_rssiThreshold = SL_LINK_RSSI_THRESHOLD;
+	_snrThreshold = SL_LINK_SNR_THRESHOLD;
+	
+	memset(&_statsPrev, 0, sizeof(_statsPrev));
+	memset(&_stats, 0, sizeof(_stats));
+	_statsBaseline = false;
+	_statsValid = false;
+	_statsInterval = SL_STATS_INTERVAL_MS;
+	_statsSampled = 0;
+	
+	_txLen = 0;
+	_txAttempts = 0;
+	_txStarted = 0;
+	_txRetryPending = false;
+	_txRetryAt = 0;
+	_retryBudget = SL_RETRY_BUDGET;
+	_retryBase = SL_RETRY_BASE_MS;
+	_retryMax = SL_RETRY_MAX_MS;
+	_txCallback = NULL;
+	_txHandler = NULL;
+	_txContext = NULL;
+	
+	_journal = NULL;
+	_txFromJournal = false;
+	
+	memset(_queues, 0, sizeof(_queues));
+	_txPriority = PRIORITY_NORMAL;
+	memset(_passed, 0, sizeof(_passed));
+	
+	_fragSize = SL_FRAG_SIZE;
+	_fragPriority = PRIORITY_BULK;
+	_largeReady = false;
 	
+	_airtime.configure(SL_DUTY_WINDOW_MS, SL_DUTY_PERMILLE);
+	memset(&_radio, 0, sizeof(_radio));
+	_radioValid = false;
+	
+	_clockInterval = SL_CLOCK_SYNC_INTERVAL_MS;
+	_clockSynced = 0;
+	_clockRequested = false;
+	
+	_sequencing = false;
+	_compress = false;
+	
+	_uartFd = -1;
+	_irqFd = -1;
 }
 
 boolean SymphonyLink::setAntenna(AntennaMode ant)
 {
+	selectTransport();
+	
 	if(0 > ll_antenna_set(ant))
 	{
 		Serial.write("Error ll_antenna_set\n");
@@ -176,166 +293,1322 @@ boolean SymphonyLink::getState(void)
 }
 	
 
-boolean SymphonyLink::begin(uint32_t net_token, uint8_t* app_token, DownlinkMode dl_mode, uint8_t qos)
+void SymphonyLink::setPowerMode(PowerMode mode)
 {
-	uint8_t i;
-	ll_mac_type_t mac_mode;
+	_powerMode = mode;
+	
+	if((mode == POWER_ALWAYS_ON) && _asleep)
+	{
+		selectTransport();
+		wake();
+	}
+}
+
+void SymphonyLink::scheduleWake(uint32_t delay_ms)
+{
+	//Wake slightly ahead of the send so it isn't delayed by the wakeup
+	if(delay_ms > SL_WAKE_LEAD_MS)
+	{
+		delay_ms -= SL_WAKE_LEAD_MS;
+	}
+	else
+	{
+		delay_ms = 0;
+	}
 	
+	_wakeAt = millis() + delay_ms;
+	_wakeScheduled = true;
+}
+
+boolean SymphonyLink::isAsleep(void)
+{
+	return _asleep;
+}
+
+void SymphonyLink::setCurrentProfile(uint32_t sleep_uA, uint32_t idle_uA, uint32_t tx_uA)
+{
+	accountPower();
 	
-	getIRQ(0);
+	_sleepCurrent = sleep_uA;
+	_idleCurrent = idle_uA;
+	_txCurrent = tx_uA;
+}
+
+uint32_t SymphonyLink::getEnergyUsed(void)
+{
+	accountPower();
+	
+	//uA*ms to uAh
+	return (uint32_t)(_charge / 3600000UL);
+}
+
+boolean SymphonyLink::hasPendingWork(void)
+{
+	//Not connected yet, message in flight, a downlink waiting to be read or
+	//a large transfer still going
+	if((_state != READ_TO_SEND) || (_rxState == LL_RX_STATE_RECEIVED_MSG) || _fragTx.busy())
+	{
+		return true;
+	}
 	
+	//Always-on downlink requires the receiver to stay up
+	return (_downlink_mode == LL_DL_ALWAYS_ON);
+}
+
+void SymphonyLink::accountPower(void)
+{
+	uint32_t now = millis();
+	uint32_t elapsed = now - _powerTick;
+	uint32_t current;
 	
+	_powerTick = now;
 	
-	//Read the MAC mode of the module.  Set to Symphony Link mode if not already set
-	if(0 > ll_mac_mode_get(&mac_mode))
+	if(_asleep)
 	{
-		Serial.write("Error ll_mac_mode_get\n");
-		return false;
+		current = _sleepCurrent;
+	}
+	else if(_state == SENDING_FRAME)
+	{
+		current = _txCurrent;
+	}
+	else
+	{
+		current = _idleCurrent;
+	}
+	
+	_charge += (uint64_t)current * elapsed;
+}
+
+void SymphonyLink::managePower(void)
+{
+	if((_powerMode != POWER_DUTY_CYCLED) || _asleep)
+	{
+		return;
 	}
 	
+	if(hasPendingWork())
+	{
+		//Keep the module from dozing off in the middle of a transaction
+		if(!_sleepBlocked && (0 <= ll_sleep_block()))
+		{
+			_sleepBlocked = true;
+		}
+		return;
+	}
 	
-	//Setting the mode requires the module to reset and a 2 second delay should be inserted
-	//until the module's host interface is back on line.
-	if(mac_mode != SYMPHONY_LINK)
+	//Sleep through the retry backoff, waking in time to re-send
+	if(_txRetryPending)
 	{
-		if(0 > ll_mac_mode_set(SYMPHONY_LINK))
+		int32_t remaining = (int32_t)(_txRetryAt - millis());
+		
+		if(remaining <= (int32_t)SL_WAKE_LEAD_MS)
 		{
-			Serial.write("Error ll_mac_mode_set\n");
-			return false;
+			return;
+		}
+		if(!_wakeScheduled || (int32_t)(_wakeAt - _txRetryAt) > 0)
+		{
+			scheduleWake(remaining);
 		}
-		Serial.write("Setting to Symphony Link Mode\n");
-		delay(2000);
 	}
 	
-	_net_token = net_token;
-
-	//Make local copy of apptoken
-	for(i=0;i<APP_TOKEN_LEN; i++)
+	if(_wakeScheduled && (int32_t)(_wakeAt - millis()) <= (int32_t)SL_WAKE_LEAD_MS)
 	{
-		_app_token[i] = app_token[i];
+		//Not worth sleeping for the time left
+		return;
+	}
+	
+	if(_sleepBlocked)
+	{
+		if(0 > ll_sleep_unblock())
+		{
+			Serial.write("Error ll_sleep_unblock\n");
+			return;
+		}
+		_sleepBlocked = false;
+	}
+	
+	if(0 > ll_sleep())
+	{
+		Serial.write("Error ll_sleep\n");
+		return;
 	}
+	
+	accountPower();
+	_asleep = true;
+}
 
-	switch (dl_mode)
+boolean SymphonyLink::wake(void)
+{
+	accountPower();
+	
+	_asleep = false;
+	_wakeScheduled = false;
+	
+	//Any traffic on the host UART wakes the module.  The first command may be
+	//lost while it comes up, so allow a second attempt.
+	if(!getIRQ(0))
 	{
-		case OFF:
-			_downlink_mode = LL_DL_OFF;
-			break;
-			
-		case ON:
-			_downlink_mode = LL_DL_ALWAYS_ON;
-			break;
-			
-		case MAILBOX:
-			_downlink_mode = LL_DL_MAILBOX;
-			break;
+		delay(SL_READY_POLL_INTERVAL_MS);
+		if(!getIRQ(0))
+		{
+			return false;
+		}
 	}
 	
-	_qos = qos;
+	//Pick up any downlink that arrived for us while we were asleep
+	if(_downlink_mode == LL_DL_MAILBOX)
+	{
+		ll_mailbox_request();
+	}
+	
+	return true;
+}
+
+void SymphonyLink::setLinkMonitor(uint32_t interval_ms, int16_t rssi_threshold, int8_t snr_threshold)
+{
+	_linkInterval = interval_ms;
+	_rssiThreshold = rssi_threshold;
+	_snrThreshold = snr_threshold;
+}
+
+boolean SymphonyLink::getLinkQuality(LinkQuality* quality)
+{
+	gatewayStats* gw;
 	
-	delay(100);
+	if(_gateway < 0)
+	{
+		return false;
+	}
 	
-	updateModemState();
+	gw = &_gateways[_gateway];
+	quality->gateway_id = gw->gateway_id;
+	quality->channel = _gatewayChannel;
+	quality->rssi = gw->rssi_avg >> SL_LINK_EWMA_SHIFT;
+	quality->snr = gw->snr_avg >> SL_LINK_EWMA_SHIFT;
+	quality->rssi_min = gw->rssi_min;
+	quality->rssi_max = gw->rssi_max;
+	quality->snr_min = gw->snr_min;
+	quality->snr_max = gw->snr_max;
+	quality->samples = gw->samples;
+	quality->degraded = _linkDegraded;
 	return true;
+}
 
+boolean SymphonyLink::isLinkDegraded(void)
+{
+	return _linkDegraded;
 }
 
+boolean SymphonyLink::canSendBulk(void)
+{
+	//Bulk traffic waits for a stable link; small urgent messages don't ask
+	return (_state == READ_TO_SEND) && !_linkDegraded && !_scanning;
+}
 
+void SymphonyLink::sampleLink(void)
+{
+	llabs_network_info_t info;
+	
+	if((_linkInterval == 0) ||
+	   ((_gateway >= 0) && ((millis() - _linkSampled) < _linkInterval)))
+	{
+		return;
+	}
+	
+	_linkSampled = millis();
+	
+	if(0 > ll_net_info_get(&info))
+	{
+		Serial.write("Error ll_net_info_get\n");
+		return;
+	}
+	
+	updateLinkQuality(&info);
+}
 
-boolean SymphonyLink::write(uint8_t* buf, uint16_t len)
+void SymphonyLink::updateLinkQuality(const llabs_network_info_t* info)
 {
-	int32_t ret;
+	gatewayStats* gw;
+	uint8_t i;
+	uint8_t slot = 0;
 	
-	updateModemState();
+	_scanning = (info->is_scanning_gateways != 0);
+	_gatewayChannel = info->gateway_channel;
+	
+	if(info->connection_status != LLABS_CONNECT_CONNECTED)
+	{
+		_linkDegraded = true;
+		return;
+	}
 	
-	if (_state==READ_TO_SEND)
-	{							
-		ret = ll_message_send_ack(buf,len);
-		if(ret<0)
+	//Find the gateway, or recycle an empty or the least recently seen entry
+	for(i = 0; i < SL_LINK_MAX_GATEWAYS; i++)
+	{
+		if((_gateways[i].samples != 0) && (_gateways[i].gateway_id == info->gateway_id))
 		{
-			Serial.write("Error sending frame\n");
-			updateModemState();
-			return false;
+			slot = i;
+			break;
 		}
-		else
+		if((_gateways[slot].samples != 0) &&
+		   ((_gateways[i].samples == 0) || ((int32_t)(_gateways[i].last_seen - _gateways[slot].last_seen) < 0)))
 		{
-			while(_state != SENDING_FRAME)
-			{
-				updateModemState();
-				delay(100);
-			}
+			slot = i;
 		}
 	}
+	
+	gw = &_gateways[slot];
+	if((gw->samples == 0) || (gw->gateway_id != info->gateway_id))
+	{
+		gw->gateway_id = info->gateway_id;
+		gw->rssi_avg = info->rssi * (1 << SL_LINK_EWMA_SHIFT);
+		gw->snr_avg = info->snr * (1 << SL_LINK_EWMA_SHIFT);
+		gw->rssi_min = gw->rssi_max = info->rssi;
+		gw->snr_min = gw->snr_max = info->snr;
+		gw->samples = 0;
+	}
 	else
 	{
-		return false;
+		gw->rssi_avg += info->rssi - (gw->rssi_avg >> SL_LINK_EWMA_SHIFT);
+		gw->snr_avg += info->snr - (gw->snr_avg >> SL_LINK_EWMA_SHIFT);
+		gw->rssi_min = min(gw->rssi_min, info->rssi);
+		gw->rssi_max = max(gw->rssi_max, info->rssi);
+		gw->snr_min = min(gw->snr_min, info->snr);
+		gw->snr_max = max(gw->snr_max, info->snr);
 	}
 	
-	return true;
-
+	if(gw->samples < 0xFFFF)
+	{
+		gw->samples++;
+	}
+	gw->last_seen = millis();
+	_gateway = slot;
+	_lastRssi = info->rssi;
+	
+	//Degrading: averages below threshold, or the latest sample well below the
+	//average (fading), or the module is hunting for a new gateway
+	_linkDegraded = _scanning ||
+					((gw->rssi_avg >> SL_LINK_EWMA_SHIFT) < _rssiThreshold) ||
+					((gw->snr_avg >> SL_LINK_EWMA_SHIFT) < _snrThreshold) ||
+					(_lastRssi < (gw->rssi_avg >> SL_LINK_EWMA_SHIFT) - SL_LINK_DROP_DB);
 }
 
+void SymphonyLink::setStatsInterval(uint32_t interval_ms)
+{
+	_statsInterval = interval_ms;
+}
 
-boolean SymphonyLink::read(uint8_t* buf, uint8_t* len)
+boolean SymphonyLink::sampleStats(void)
 {
-	int16_t rssi;
-	uint8_t snr;
-	int32_t ret;
+	llabs_stats_t cur;
+	uint32_t now = millis();
 	
-	if (_rxState == LL_RX_STATE_RECEIVED_MSG)
+	selectTransport();
+	if(0 > ll_stats_get(&cur))
 	{
-			ret = ll_retrieve_message(buf,len, &rssi, &snr);
-			if (ret<0)
-			{
-				Serial.print("Error ll_retrieve_message\n");
-				return false;
-			}
-			else
-			{
-				return true;
-			}
+		Serial.write("Error ll_stats_get\n");
+		return false;
 	}
-	else
+	
+	if(_statsBaseline)
 	{
-		return false;
+		updateStats(&cur, now - _statsSampled);
 	}
 	
+	_statsPrev = cur;
+	_statsBaseline = true;
+	_statsSampled = now;
+	return true;
 }
 
+boolean SymphonyLink::getStats(LinkStats* stats)
+{
+	if(!_statsValid)
+	{
+		return false;
+	}
+	
+	*stats = _stats;
+	return true;
+}
 
+//Counters restart from zero when the module resets
+static uint32_t counterDelta(uint32_t cur, uint32_t prev)
+{
+	return (cur >= prev) ? (cur - prev) : cur;
+}
 
-int32_t transport_write(uint8_t* buf, uint16_t len)
+void SymphonyLink::updateStats(const llabs_stats_t* cur, uint32_t elapsed)
 {
+	llabs_stats_t* d = &_stats.delta;
+	uint32_t acked;
+	
+	d->num_send_calls = counterDelta(cur->num_send_calls, _statsPrev.num_send_calls);
+	d->num_pkts_transmitted = counterDelta(cur->num_pkts_transmitted, _statsPrev.num_pkts_transmitted);
+	d->num_gateway_scans = counterDelta(cur->num_gateway_scans, _statsPrev.num_gateway_scans);
+	d->num_collisions = counterDelta(cur->num_collisions, _statsPrev.num_collisions);
+	d->num_ack_successes = counterDelta(cur->num_ack_successes, _statsPrev.num_ack_successes);
+	d->num_ack_failures = counterDelta(cur->num_ack_failures, _statsPrev.num_ack_failures);
+	d->num_sync_failures = counterDelta(cur->num_sync_failures, _statsPrev.num_sync_failures);
+	d->num_canceled_pkts_ack = counterDelta(cur->num_canceled_pkts_ack, _statsPrev.num_canceled_pkts_ack);
+	d->num_canceled_pkts_csma = counterDelta(cur->num_canceled_pkts_csma, _statsPrev.num_canceled_pkts_csma);
+	d->num_rx_errors = counterDelta(cur->num_rx_errors, _statsPrev.num_rx_errors);
+	
+	_stats.interval_ms = elapsed;
 	
-    int32_t ret;	
+	_stats.retx_per_send = 0;
+	if((d->num_send_calls != 0) && (d->num_pkts_transmitted > d->num_send_calls))
+	{
+		_stats.retx_per_send = (float)(d->num_pkts_transmitted - d->num_send_calls) / d->num_send_calls;
+	}
 	
-    ret = Serial1.write(buf, len);
+	_stats.collision_ratio = 0;
+	if((d->num_pkts_transmitted + d->num_collisions) != 0)
+	{
+		_stats.collision_ratio = (float)d->num_collisions / (d->num_pkts_transmitted + d->num_collisions);
+	}
 	
+	acked = d->num_ack_successes + d->num_ack_failures;
+	_stats.ack_success_ratio = (acked != 0) ? ((float)d->num_ack_successes / acked) : 1.0f;
 	
-    if (ret < 0) {
-        return -1;
-    }
+	_statsValid = true;
+}
+
+void SymphonyLink::setRetryPolicy(uint8_t budget, uint32_t base_ms, uint32_t max_ms)
+{
+	_retryBudget = budget;
+	_retryBase = base_ms;
+	_retryMax = max_ms;
+}
 
-    return 0;
+void SymphonyLink::setTxCallback(TxDoneCallback cb)
+{
+	_txCallback = cb;
+}
+
+void SymphonyLink::setTxHandler(TxDoneHandler handler, void* ctx)
+{
+	_txHandler = handler;
+	_txContext = ctx;
 }
 
+boolean SymphonyLink::isSending(void)
+{
+	return (_txLen != 0);
+}
 
-int32_t transport_read(uint8_t *buf, uint16_t len)
+boolean SymphonyLink::sendRetained(void)
 {
-   
+	uint32_t airtime = 0;
+	uint32_t wait = 0;
+	
+	//Without a budget there is nothing to charge, so don't ask the module
+	if(_airtime.enabled())
+	{
+		airtime = timeOnAir(_txLen);
+		wait = _airtime.waitTime(airtime, millis());
+	}
+	
+	//A frame longer than the whole budget would be held forever and stall
+	//everything queued behind it, so it fails instead
+	if(airtime > _airtime.limit())
+	{
+		Serial.write("Error frame exceeds airtime budget\n");
+		txComplete(false);
+		return true;
+	}
+	
+	//Hold the frame until the duty-cycle budget has room.  This doesn't count
+	//as an attempt; the retry timer brings it back when the budget allows.
+	if(wait != 0)
+	{
+		_txRetryAt = millis() + wait;
+		_txRetryPending = true;
+		return true;
+	}
+	
+	_txAttempts++;
+	_txRetryPending = false;
+	
+	if(0 > ll_message_send_ack(_txBuf, _txLen))
+	{
+		Serial.write("Error sending frame\n");
+		return false;
+	}
 	
-    uint8_t ret;
-   
-    uint32_t timeout_val = (500 * 1);
+	_airtime.record(airtime, millis());
+	_txStarted = millis();
+	_state = SENDING_FRAME;
+	return true;
+}
 
-	Serial1.setTimeout(timeout_val);
-	ret = Serial1.readBytes(buf, len); 
+void SymphonyLink::txFailed(void)
+{
+	uint32_t backoff = _retryBase;
+	uint8_t i;
+	
+	if(_txAttempts > _retryBudget)
+	{
+		Serial.write("Frame failed, retries exhausted\n");
+		txComplete(false);
+		return;
+	}
+	
+	//Exponential backoff with equal jitter so colliding nodes spread out
+	for(i = 1; (i < _txAttempts) && (backoff < _retryMax); i++)
+	{
+		backoff <<= 1;
+	}
+	if(backoff > _retryMax)
+	{
+		backoff = _retryMax;
+	}
+	backoff = (backoff / 2) + random((backoff / 2) + 1);
+	
+	_txRetryAt = millis() + backoff;
+	_txRetryPending = true;
+}
 
-	if (ret > 0) 
+void SymphonyLink::txComplete(boolean success)
+{
+	boolean report = true;
+	
+	_txRetryPending = false;
+	
+	if(_txFromJournal)
+	{
+		//A frame that failed because the link went down stays journaled and
+		//is sent again later, so it isn't reported until it is done with
+		if(success || (_modState == LL_STATE_IDLE_CONNECTED))
+		{
+			_journal->pop();
+		}
+		else
+		{
+			report = false;
+		}
+		_txFromJournal = false;
+	}
+	
+	if(report && (_txCallback != NULL))
 	{
-			return(ret);
+		_txCallback(_txBuf, _txLen, success);
 	}
-	else
+	if(report && (_txHandler != NULL))
 	{
-		  return(-1);
+		_txHandler(_txContext, _txBuf, _txLen, success);
 	}
+	
+	_txLen = 0;
+	_txAttempts = 0;
+}
+
+void SymphonyLink::setDutyCycle(uint16_t duty_permille, uint32_t window_ms)
+{
+	_airtime.configure(window_ms, duty_permille);
+}
+
+uint32_t SymphonyLink::timeOnAir(uint16_t len)
+{
+	if(!_radioValid)
+	{
+		selectTransport();
+		loadRadioParams();
+	}
+	
+	//ms, rounded up so the budget never undercounts
+	return (airtimeUs(&_radio, len + SL_AIRTIME_OVERHEAD) + 999) / 1000;
+}
+
+uint32_t SymphonyLink::getAirtimeUsed(void)
+{
+	return _airtime.used(millis());
+}
+
+uint32_t SymphonyLink::getAirtimeLimit(void)
+{
+	return _airtime.limit();
+}
+
+void SymphonyLink::loadRadioParams(void)
+{
+	uint32_t freq;
+	uint8_t iq;
+	
+	if(0 <= ll_radio_params_get(&_radio.sf, &_radio.cr, &_radio.bw, &freq, &_radio.preamble_syms,
+								&_radio.header_enabled, &_radio.crc_enabled, &iq))
+	{
+		_radioValid = true;
+		return;
+	}
+	
+	//Unknown settings are budgeted as the slowest ones so the limit still holds.
+	//They stand until the next reconfiguration rather than being asked for
+	//again on every send.
+	Serial.write("Error ll_radio_params_get\n");
+	_radio.sf = 12;
+	_radio.cr = 4;
+	_radio.bw = 0;
+	_radio.preamble_syms = 8;
+	_radio.header_enabled = 1;
+	_radio.crc_enabled = 1;
+	_radioValid = true;
+}
+
+void SymphonyLink::setClockSyncInterval(uint32_t interval_ms)
+{
+	_clockInterval = interval_ms;
+}
+
+boolean SymphonyLink::timeValid(void)
+{
+	return _clock.valid();
+}
+
+uint64_t SymphonyLink::now(void)
+{
+	//Answered from the local clock, no host interface traffic
+	return _clock.now();
+}
+
+int32_t SymphonyLink::getClockDrift(void)
+{
+	return _clock.driftPpb();
+}
+
+void SymphonyLink::syncClock(void)
+{
+	uint32_t interval = _clock.valid() ? _clockInterval : SL_CLOCK_RETRY_MS;
+	
+	if((_clockInterval == 0) || ((_clockSynced != 0) && ((millis() - _clockSynced) < interval)))
+	{
+		return;
+	}
+	_clockSynced = millis() | 1;
+	
+	if(!_clock.sync() && !_clockRequested)
+	{
+		//The module hasn't got network time yet, have it pick it up when it can
+		_clockRequested = _clock.requestSync(true);
+	}
+}
+
+void SymphonyLink::attachJournal(SymphonyLinkJournal* journal)
+{
+	_journal = journal;
+}
+
+uint16_t SymphonyLink::pendingUplinks(void)
+{
+	uint16_t pending = (_txLen != 0) ? 1 : 0;
+	uint8_t i;
+	
+	for(i = 0; i < NUM_PRIORITIES; i++)
+	{
+		pending += _queues[i].count;
+	}
+	if(_journal != NULL)
+	{
+		pending += _journal->count();
+	}
+	return pending;
+}
+
+boolean SymphonyLink::enqueue(Priority priority, const uint8_t* buf, uint16_t len, uint8_t attempts, boolean front)
+{
+	frameQueue* q = &_queues[priority];
+	queuedFrame* f;
+	
+	if((q->count >= SL_TX_QUEUE_DEPTH) || (len > SL_QUEUE_MSG_LEN))
+	{
+		return false;
+	}
+	
+	if(front)
+	{
+		q->head = (q->head + SL_TX_QUEUE_DEPTH - 1) % SL_TX_QUEUE_DEPTH;
+		f = &q->frames[q->head];
+	}
+	else
+	{
+		f = &q->frames[(q->head + q->count) % SL_TX_QUEUE_DEPTH];
+	}
+	
+	memcpy(f->data, buf, len);
+	f->len = len;
+	f->attempts = attempts;
+	q->count++;
+	return true;
+}
+
+boolean SymphonyLink::dequeue(Priority priority)
+{
+	frameQueue* q = &_queues[priority];
+	queuedFrame* f = &q->frames[q->head];
+	
+	if(q->count == 0)
+	{
+		return false;
+	}
+	
+	memcpy(_txBuf, f->data, f->len);
+	_txLen = f->len;
+	_txAttempts = f->attempts;
+	_txPriority = priority;
+	_txFromJournal = false;
+	
+	q->head = (q->head + 1) % SL_TX_QUEUE_DEPTH;
+	q->count--;
+	return true;
+}
+
+int8_t SymphonyLink::nextUplinkSource(void)
+{
+	boolean ready[NUM_SOURCES];
+	int8_t first = -1;
+	int8_t pick = -1;
+	int8_t i;
+	
+	ready[SOURCE_HIGH] = (_queues[PRIORITY_HIGH].count != 0);
+	ready[SOURCE_NORMAL] = (_queues[PRIORITY_NORMAL].count != 0);
+	ready[SOURCE_JOURNAL] = (_journal != NULL) && (_journal->count() != 0);
+	ready[SOURCE_BULK] = (_queues[PRIORITY_BULK].count != 0) && canSendBulk();
+	
+	for(i = 0; i < NUM_SOURCES; i++)
+	{
+		if(!ready[i])
+		{
+			_passed[i] = 0;
+		}
+		else if(first < 0)
+		{
+			first = i;
+		}
+	}
+	
+	if(first < 0)
+	{
+		return -1;
+	}
+	
+	//Strict priority, except that every lower class passed over the quota
+	//times gets a send, the longest waiting first, so no class starves
+	//however the ones above it alternate.  Alarms are never held.
+	pick = first;
+	if(first != SOURCE_HIGH)
+	{
+		for(i = first + 1; i < NUM_SOURCES; i++)
+		{
+			if(ready[i] && (_passed[i] >= SL_PRIORITY_QUOTA) &&
+			   ((pick == first) || (_passed[i] > _passed[pick])))
+			{
+				pick = i;
+			}
+		}
+	}
+	
+	for(i = SOURCE_NORMAL; i < NUM_SOURCES; i++)
+	{
+		if(i == pick)
+		{
+			_passed[i] = 0;
+		}
+		else if(ready[i] && (first != SOURCE_HIGH) && (_passed[i] < 0xFF))
+		{
+			_passed[i]++;
+		}
+	}
+	
+	return pick;
+}
+
+void SymphonyLink::serviceUplink(void)
+{
+	int32_t len;
+	
+	if(_txRetryPending)
+	{
+		//An alarm pre-empts a lower class frame waiting out its backoff
+		if((_queues[PRIORITY_HIGH].count != 0) && (_txFromJournal || (_txPriority != PRIORITY_HIGH)))
+		{
+			if(_txFromJournal || enqueue(_txPriority, _txBuf, _txLen, _txAttempts, true))
+			{
+				//journaled frames simply stay in the journal
+				_txRetryPending = false;
+				_txFromJournal = false;
+				_txLen = 0;
+			}
+		}
+		
+		if(_txRetryPending)
+		{
+			if((int32_t)(millis() - _txRetryAt) >= 0)
+			{
+				if(_txAttempts != 0)
+				{
+					Serial.write("Retrying frame\n");
+				}
+				if(!sendRetained())
+				{
+					txFailed();
+				}
+			}
+			return;
+		}
+	}
+	
+	if(_txLen != 0)
+	{
+		return;
+	}
+	
+	switch(nextUplinkSource())
+	{
+		case SOURCE_HIGH:
+			dequeue(PRIORITY_HIGH);
+			break;
+			
+		case SOURCE_NORMAL:
+			dequeue(PRIORITY_NORMAL);
+			break;
+			
+		case SOURCE_BULK:
+			dequeue(PRIORITY_BULK);
+			break;
+			
+		case SOURCE_JOURNAL:
+			//Drain messages stored while the link was down
+			len = _journal->peek(_txBuf, SL_MAX_TX_LEN);
+			if(len == JOURNAL_CORRUPT)
+			{
+				Serial.write("Error journal record dropped\n");
+				_journal->pop();
+				return;
+			}
+			if(len <= 0)
+			{
+				//Tried again on the next pass
+				Serial.write("Error reading journal\n");
+				return;
+			}
+			_txLen = (uint16_t)len;
+			_txAttempts = 0;
+			_txPriority = PRIORITY_NORMAL;
+			_txFromJournal = true;
+			break;
+			
+		default:
+			return;
+	}
+	
+	if(!sendRetained())
+	{
+		txFailed();
+	}
+}
+
+boolean SymphonyLink::waitForReady(uint32_t timeout_ms)
+{
+	selectTransport();
+	return moduleWaitForReady(timeout_ms, &_IRQ);
+}
+
+boolean SymphonyLink::begin(uint32_t net_token, uint8_t* app_token, DownlinkMode dl_mode, uint8_t qos)
+{
+	uint8_t i;
+	
+	
+	selectTransport();
+	getIRQ(0);
+	
+	
+	
+	//Set to Symphony Link mode if not already set
+	if(!moduleSetMacMode(SYMPHONY_LINK))
+	{
+		return false;
+	}
+	
+	_net_token = net_token;
+
+	//Make local copy of apptoken
+	for(i=0;i<APP_TOKEN_LEN; i++)
+	{
+		_app_token[i] = app_token[i];
+	}
+
+	switch (dl_mode)
+	{
+		case OFF:
+			_downlink_mode = LL_DL_OFF;
+			break;
+			
+		case ON:
+			_downlink_mode = LL_DL_ALWAYS_ON;
+			break;
+			
+		case MAILBOX:
+			_downlink_mode = LL_DL_MAILBOX;
+			break;
+	}
+	
+	_qos = qos;
+	
+	updateModemState();
+	return true;
+
+}
+
+
+
+boolean SymphonyLink::write(uint8_t* buf, uint16_t len, Priority priority)
+{
+	uint8_t frame[SL_MAX_TX_LEN];
+	uint16_t packed;
+	
+	selectTransport();
+	if(_asleep)
+	{
+		wake();
+	}
+	
+	updateModemState();
+	
+	if((len == 0) || (len > SL_MAX_TX_LEN) || (priority >= NUM_PRIORITIES))
+	{
+		return false;
+	}
+	
+	//Compress before anything is queued or journaled.  Uncompressible data
+	//that looks like a compressed frame is escaped.
+	if(_compress)
+	{
+		packed = lzCompress(buf, len, frame, sizeof(frame));
+		if((packed == 0) && lzIsCompressed(buf, len))
+		{
+			packed = lzStore(buf, len, frame, sizeof(frame));
+			if(packed == 0)
+			{
+				return false;
+			}
+		}
+		if(packed != 0)
+		{
+			buf = frame;
+			len = packed;
+		}
+	}
+	
+	//Refused on every path, not just when the frame happens to need queueing
+	if(len > SL_QUEUE_MSG_LEN)
+	{
+		Serial.write("Error frame longer than a queue slot\n");
+		return false;
+	}
+	
+	if(_airtime.enabled() && (timeOnAir(len) > _airtime.limit()))
+	{
+		Serial.write("Error frame exceeds airtime budget\n");
+		return false;
+	}
+	
+	//Send straight away when nothing is ahead of this message
+	if((_state == READ_TO_SEND) && (pendingUplinks() == 0) &&
+	   ((priority != PRIORITY_BULK) || canSendBulk()))
+	{
+		memcpy(_txBuf, buf, len);
+		_txLen = len;
+		_txAttempts = 0;
+		_txPriority = priority;
+		_txFromJournal = false;
+		
+		if(!sendRetained())
+		{
+			_txLen = 0;
+			updateModemState();
+			return false;
+		}
+		return true;
+	}
+	
+	//While the link is down routine traffic goes to the journal so it
+	//survives a reset; alarms stay in RAM so they go out first
+	if((_journal != NULL) && (priority != PRIORITY_HIGH) &&
+	   (_state != READ_TO_SEND) && (_state != SENDING_FRAME))
+	{
+		if(!_journal->append(buf, len))
+		{
+			Serial.write("Error journal append\n");
+			return false;
+		}
+		return true;
+	}
+	
+	if(enqueue(priority, buf, len, 0, false))
+	{
+		return true;
+	}
+	
+	//Class queue is full, fall back on the journal
+	if((_journal != NULL) && _journal->append(buf, len))
+	{
+		return true;
+	}
+	
+	Serial.write("Error uplink queue full\n");
+	return false;
+}
+
+
+boolean SymphonyLink::read(uint8_t* buf, uint8_t* len, uint8_t* stream)
+{
+	int16_t rssi;
+	uint8_t snr;
+	int32_t ret;
+	uint8_t id = SEQ_NO_STREAM;
+	SeqResult result;
+	
+	//Messages held back for ordering go out as soon as they are next in line
+	if(!_sequencing || !_sequencer.pop(buf, len, &id, millis()))
+	{
+		if (_rxState != LL_RX_STATE_RECEIVED_MSG)
+		{
+			return false;
+		}
+		
+		selectTransport();
+		ret = ll_retrieve_message(buf,len, &rssi, &snr);
+		if (ret<0)
+		{
+			Serial.print("Error ll_retrieve_message\n");
+			return false;
+		}
+		
+		if(_sequencing)
+		{
+			//Held for ordering or a duplicate
+			result = _sequencer.push(buf, len, millis(), &id);
+			if((result == SEQ_HELD) || (result == SEQ_DUPLICATE))
+			{
+				return false;
+			}
+			if(result == SEQ_DROPPED)
+			{
+				Serial.write("Error downlink too long to hold for ordering\n");
+				return false;
+			}
+		}
+	}
+	
+	if(stream != NULL)
+	{
+		*stream = id;
+	}
+	
+	//Fragments and fragment acks are consumed here
+	return !handleFragment(buf, *len);
+}
+
+void SymphonyLink::setDownlinkSequencing(boolean enable)
+{
+	_sequencing = enable;
+	_sequencer.reset();
+}
+
+uint32_t SymphonyLink::getDuplicateCount(void)
+{
+	return _sequencer.duplicates();
+}
+
+void SymphonyLink::setCompression(boolean enable)
+{
+	_compress = enable;
+}
+
+
+
+boolean SymphonyLink::writeLarge(const uint8_t* buf, uint16_t len, boolean reliable)
+{
+	//buf must stay valid until isWritingLarge() returns false
+	if(!_fragTx.start(buf, len, _fragSize, reliable))
+	{
+		Serial.write("Error starting large write\n");
+		return false;
+	}
+	updateModemState();
+	return true;
+}
+
+boolean SymphonyLink::isWritingLarge(void)
+{
+	return _fragTx.busy();
+}
+
+void SymphonyLink::setFragmentSize(uint8_t frag_size, Priority priority)
+{
+	if((frag_size != 0) && (frag_size <= SL_FRAG_SIZE))
+	{
+		_fragSize = frag_size;
+	}
+	_fragPriority = priority;
+}
+
+void SymphonyLink::setReassemblyBuffer(uint8_t* buf, uint16_t size)
+{
+	_fragRx.begin(buf, size, SL_FRAG_RX_MAX_FRAGMENTS);
+	_largeReady = false;
+}
+
+uint8_t* SymphonyLink::readLarge(uint16_t* len)
+{
+	if(!_largeReady)
+	{
+		return NULL;
+	}
+	
+	_largeReady = false;
+	*len = _fragRx.length();
+	return _fragRx.data();
+}
+
+void SymphonyLink::serviceFragments(void)
+{
+	uint8_t frame[SL_QUEUE_MSG_LEN];
+	uint16_t len;
+	
+	if(_fragTx.poll(millis(), SL_FRAG_ACK_TIMEOUT_MS) == FRAG_ERROR)
+	{
+		Serial.write("Large write failed\n");
+	}
+	_fragRx.poll(millis(), SL_FRAG_RX_TIMEOUT_MS);
+	
+	//Feed one fragment at a time so the transfer doesn't crowd out the class
+	if(_queues[_fragPriority].count != 0)
+	{
+		return;
+	}
+	
+	len = _fragTx.next(frame, sizeof(frame), millis());
+	if(len != 0)
+	{
+		enqueue(_fragPriority, frame, len, 0, false);
+	}
+}
+
+boolean SymphonyLink::handleFragment(const uint8_t* buf, uint8_t len)
+{
+	uint8_t ack[SL_QUEUE_MSG_LEN];
+	uint16_t ackLen;
+	FragResult result;
+	
+	//Acks only mean something while a large write is out, and fragments
+	//only once a reassembly buffer is set; otherwise the frame is the app's
+	if(_fragTx.busy() && (_fragTx.handleAck(buf, len) != FRAG_NONE))
+	{
+		return true;
+	}
+	
+	if(!_fragRx.enabled())
+	{
+		return false;
+	}
+	
+	result = _fragRx.push(buf, len, millis());
+	if(result == FRAG_NONE)
+	{
+		return false;
+	}
+	
+	if(result == FRAG_COMPLETE)
+	{
+		_largeReady = true;
+	}
+	
+	if(_fragRx.ackNeeded())
+	{
+		ackLen = _fragRx.buildAck(ack, sizeof(ack));
+		if((ackLen == 0) || !enqueue(PRIORITY_NORMAL, ack, ackLen, 0, false))
+		{
+			Serial.write("Error queueing fragment ack\n");
+		}
+	}
+	return true;
+}
+
+
+#if defined(__linux__)
+boolean SymphonyLink::openTransport(const char* tty)
+{
+	struct termios tio;
+	int fd;
+	
+	fd = ::open(tty, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return false;
+	}
+	
+	//Raw 115200 8-N-1, reads return whatever is there
+	if(tcgetattr(fd, &tio) < 0)
+	{
+		::close(fd);
+		return false;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, B115200);
+	cfsetospeed(&tio, B115200);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	if(tcsetattr(fd, TCSANOW, &tio) < 0)
+	{
+		::close(fd);
+		return false;
+	}
+	tcflush(fd, TCIOFLUSH);
+	
+	_uartFd = fd;
+	return true;
+}
+
+boolean SymphonyLink::attachIrq(const char* gpio_value_path)
+{
+	char c[4];
+	int fd;
+	
+	//A sysfs GPIO value file with its edge set signals POLLPRI on an edge
+	fd = ::open(gpio_value_path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return false;
+	}
+	if(::read(fd, c, sizeof(c)) < 0)
+	{
+		::close(fd);
+		return false;
+	}
+	
+	_irqFd = fd;
+	return true;
+}
+
+int SymphonyLink::fd(void)
+{
+	return _irqFd;
+}
+#endif
+
+modemState SymphonyLink::processReady(void)
+{
+#if defined(__linux__)
+	char c[4];
+	
+	//Acknowledge the edge so the descriptor stops polling ready
+	if(_irqFd >= 0)
+	{
+		lseek(_irqFd, 0, SEEK_SET);
+		if(::read(_irqFd, c, sizeof(c)) < 0)
+		{
+			Serial.write("Error reading IRQ line\n");
+		}
+	}
+#endif
+	
+	return updateModemState();
+}
+
+uint32_t SymphonyLink::nextDeadline(void)
+{
+	return millis() + pollTimeout();
+}
+
+uint32_t SymphonyLink::pollTimeout(void)
+{
+	uint32_t now = millis();
+	uint32_t wait = SL_IDLE_DEADLINE_MS;
+	uint32_t at;
+	
+	if(_asleep)
+	{
+		//Nothing happens until the scheduled wake
+		return _wakeScheduled ? untilDeadline(now, _wakeAt, wait) : wait;
+	}
+	
+	//Without an IRQ line only polling notices downlinks and state changes
+	if(_irqFd < 0)
+	{
+		wait = SL_POLL_INTERVAL_MS;
+	}
+	
+	if(_state != READ_TO_SEND)
+	{
+		if(_state == INIT)
+		{
+			return 0;
+		}
+		return (wait < SL_IRQ_SAFETY_MS) ? wait : SL_IRQ_SAFETY_MS;
+	}
+	
+	if(_txRetryPending)
+	{
+		wait = untilDeadline(now, _txRetryAt, wait);
+	}
+	else if((_txLen == 0) &&
+			((_queues[PRIORITY_HIGH].count != 0) || (_queues[PRIORITY_NORMAL].count != 0) ||
+			 ((_journal != NULL) && (_journal->count() != 0)) ||
+			 ((_queues[PRIORITY_BULK].count != 0) && canSendBulk())))
+	{
+		return 0;
+	}
+	
+	if(_fragTx.awaitingAck())
+	{
+		wait = untilDeadline(now, _fragTx.ackSentAt() + SL_FRAG_ACK_TIMEOUT_MS, wait);
+	}
+	else if(_fragTx.busy() && (_queues[_fragPriority].count == 0))
+	{
+		return 0;
+	}
+	
+	if(_sequencing && _sequencer.gapDeadline(SL_SEQ_GAP_TIMEOUT_MS, &at))
+	{
+		wait = untilDeadline(now, at, wait);
+	}
+	
+	if(_linkInterval != 0)
+	{
+		at = (_gateway < 0) ? (now + SL_POLL_INTERVAL_MS) : (_linkSampled + _linkInterval);
+		wait = untilDeadline(now, at, wait);
+	}
+	
+	if(_statsInterval != 0)
+	{
+		wait = untilDeadline(now, _statsBaseline ? (_statsSampled + _statsInterval) : now, wait);
+	}
+	
+	if(_clockInterval != 0)
+	{
+		at = (_clockSynced == 0) ? now :
+			 (_clockSynced + (_clock.valid() ? _clockInterval : SL_CLOCK_RETRY_MS));
+		wait = untilDeadline(now, at, wait);
+	}
+	
+	return wait;
+}
+
+uint32_t SymphonyLink::untilDeadline(uint32_t now, uint32_t at, uint32_t wait)
+{
+	int32_t remaining = (int32_t)(at - now);
+	
+	if(remaining <= 0)
+	{
+		return 0;
+	}
+	return ((uint32_t)remaining < wait) ? (uint32_t)remaining : wait;
+}
+
+void SymphonyLink::selectTransport(void)
+{
+#if defined(__linux__)
+	moduleSelectTransport(_uartFd);
+#endif
 }
@@ -6,6 +6,128 @@
 #include "arduino.h"
 #include "ll_ifc_consts.h"
 #include "ll_ifc_symphony.h"
+#include "ll_ifc_no_mac.h"
+#include "SymphonyLinkJournal.h"
+#include "SymphonyLinkFrag.h"
+#include "SymphonyLinkAirtime.h"
+#include "SymphonyLinkClock.h"
+#include "SymphonyLinkSeq.h"
+#include "SymphonyLinkLz.h"
+#include "SymphonyLinkModule.h"
+#include "SymphonyLinkPriority.h"
+
+//Duty-cycled power management.  The module is woken this long before a
+//scheduled send so the host interface is up when the send is issued.
+#define SL_WAKE_LEAD_MS				(50)
+
+//Default module current draw used for the energy estimate (microamps)
+#define SL_SLEEP_CURRENT_UA			(10)
+#define SL_IDLE_CURRENT_UA			(10000)
+#define SL_TX_CURRENT_UA			(125000)
+
+//Link quality monitor.  Net info is sampled at most this often while connected
+//and averaged per gateway with an EWMA weight of 1/(2^SL_LINK_EWMA_SHIFT).
+#define SL_LINK_SAMPLE_INTERVAL_MS	(60000)
+#define SL_LINK_MAX_GATEWAYS		(4)
+#define SL_LINK_EWMA_SHIFT			(3)
+#define SL_LINK_RSSI_THRESHOLD		(-120)
+#define SL_LINK_SNR_THRESHOLD		(-10)
+#define SL_LINK_DROP_DB				(6)
+
+//Uplink retry policy.  A frame that fails with TX_ERROR, or reports neither
+//TX_DONE nor TX_ERROR within SL_TX_TIMEOUT_MS, is kept and re-sent up to
+//SL_RETRY_BUDGET times with exponential backoff and jitter.  The frame is
+//kept in RAM, so write() takes at most SL_MAX_TX_LEN bytes before
+//compression: 64 on AVR unless defined larger, where the module itself
+//would take 256.
+#ifndef SL_MAX_TX_LEN
+#if defined(__AVR__)
+#define SL_MAX_TX_LEN				(64)
+#else
+#define SL_MAX_TX_LEN				(256)
+#endif
+#endif
+#define SL_RETRY_BUDGET				(3)
+#define SL_RETRY_BASE_MS			(2000)
+#define SL_RETRY_MAX_MS				(60000)
+#define SL_TX_TIMEOUT_MS			(120000)
+
+//Uplink priority queues.  Each class holds SL_TX_QUEUE_DEPTH frames of up to
+//SL_QUEUE_MSG_LEN bytes.  Any write() may have to queue, so a frame longer
+//than that after compression is always refused: 32 bytes on AVR unless
+//defined larger.  A waiting lower class that SL_PRIORITY_QUOTA sends went
+//ahead of gets the next one, the longest waiting class first, so every
+//class keeps moving (HIGH is never held).
+#ifndef SL_TX_QUEUE_DEPTH
+#if defined(__AVR__)
+#define SL_TX_QUEUE_DEPTH			(2)
+#else
+#define SL_TX_QUEUE_DEPTH			(8)
+#endif
+#endif
+#ifndef SL_QUEUE_MSG_LEN
+#if defined(__AVR__)
+#define SL_QUEUE_MSG_LEN			(32)
+#else
+#define SL_QUEUE_MSG_LEN			(SL_MAX_TX_LEN)
+#endif
+#endif
+#define SL_PRIORITY_QUOTA			(4)
+
+//Module statistics are snapshot this often while connected
+#define SL_STATS_INTERVAL_MS		(600000)
+
+//Large payload fragmentation.  Fragments fill a queue slot and go out in the
+//bulk class; a round is re-sent when its ack doesn't arrive in time and a
+//partial downlink transfer is dropped after SL_FRAG_RX_TIMEOUT_MS of silence.
+//Downlinks starting with 0xF1-0xF3 are taken by the fragment layer only
+//while a large write is out or once setReassemblyBuffer() was called.  A
+//downlink transfer is limited to the fragments its ack bitmap can cover in
+//one queue slot.
+#if (SL_QUEUE_MSG_LEN - FRAG_HEADER_LEN) > 255
+#define SL_FRAG_SIZE				(255)
+#else
+#define SL_FRAG_SIZE				(SL_QUEUE_MSG_LEN - FRAG_HEADER_LEN)
+#endif
+#define SL_FRAG_ACK_TIMEOUT_MS		(30000)
+#define SL_FRAG_RX_TIMEOUT_MS		(120000)
+#if ((SL_QUEUE_MSG_LEN - FRAG_ACK_HEADER_LEN) * 8) < FRAG_MAX_FRAGMENTS
+#define SL_FRAG_RX_MAX_FRAGMENTS	((SL_QUEUE_MSG_LEN - FRAG_ACK_HEADER_LEN) * 8)
+#else
+#define SL_FRAG_RX_MAX_FRAGMENTS	(FRAG_MAX_FRAGMENTS)
+#endif
+
+//Duty-cycle budget.  Disabled unless a limit is set with setDutyCycle().
+//Airtime is computed from the module's radio parameters plus
+//SL_AIRTIME_OVERHEAD bytes of MAC framing per uplink.  write() refuses a
+//frame that needs more than the whole limit, and one already queued when the
+//limit is lowered fails rather than waiting.
+#define SL_DUTY_WINDOW_MS			(3600000)
+#define SL_DUTY_PERMILLE			(0)
+#define SL_AIRTIME_OVERHEAD			(0)
+
+//Network time is re-read this often while connected, and retried after
+//SL_CLOCK_RETRY_MS while the module has no time yet
+#define SL_CLOCK_SYNC_INTERVAL_MS	(600000)
+#define SL_CLOCK_RETRY_MS			(10000)
+
+//Sequenced downlinks waiting behind a missing one are released after this long
+#define SL_SEQ_GAP_TIMEOUT_MS		(30000)
+
+//Event loop integration.  The host interface is strictly command/response:
+//the module never sends on the UART unasked, it raises its IRQ line.  So
+//fd() is that line, and processReady() runs one pass of the state machine
+//whose module transactions still wait for their replies, each bounded by
+//SL_TRANSPORT_TIMEOUT_MS.  It never waits on the network, but it isn't an
+//incremental parser; a loop that can't afford a few UART round trips per
+//event should run the links on their own thread.  Without an IRQ line the
+//state machine has to be polled this often while awake; with one,
+//SL_IRQ_SAFETY_MS covers a missed edge.  Deadlines are never further out
+//than SL_IDLE_DEADLINE_MS.  extras/host/arduino.h builds the library on a
+//Linux host.
+#define SL_POLL_INTERVAL_MS			(100)
+#define SL_IRQ_SAFETY_MS			(1000)
+#define SL_IDLE_DEADLINE_MS			(60000)
 
 enum DownlinkMode
 {	
@@ -20,6 +142,43 @@ enum AntennaMode
 	TRACE = 2
 };
 
+enum PowerMode
+{
+	POWER_ALWAYS_ON = 0,
+	POWER_DUTY_CYCLED
+};
+
+typedef struct
+{
+	uint64_t gateway_id;
+	int8_t channel;
+	int16_t rssi;		//EWMA [dBm]
+	int8_t snr;			//EWMA [dB]
+	int16_t rssi_min;
+	int16_t rssi_max;
+	int8_t snr_min;
+	int8_t snr_max;
+	uint16_t samples;
+	boolean degraded;
+} LinkQuality;
+
+typedef struct
+{
+	llabs_stats_t delta;		//counter increments over the last interval
+	uint32_t interval_ms;
+	float retx_per_send;		//extra transmissions per send call
+	float collision_ratio;		//CSMA collisions per transmission attempt
+	float ack_success_ratio;	//successful acks per acked transmission
+} LinkStats;
+
+//Called when an uplink has been sent, or has failed after all retries.  A
+//journaled frame that fails because the link went down stays journaled and
+//is only reported once it is sent or dropped.
+typedef void (*TxDoneCallback)(const uint8_t* buf, uint16_t len, boolean success);
+
+//Same, with a context pointer for wrappers that serve a particular instance
+typedef void (*TxDoneHandler)(void* ctx, const uint8_t* buf, uint16_t len, boolean success);
+
 typedef enum modemState
 {
     INIT=0,
@@ -35,16 +194,106 @@ class SymphonyLink {
 	
 		SymphonyLink();
 		boolean begin(uint32_t net_token, uint8_t* app_token, DownlinkMode dl_mode, uint8_t qos);
-		boolean write(uint8_t* buf, uint16_t len);
-		boolean read (uint8_t* buf, uint8_t* len);
+		boolean waitForReady(uint32_t timeout_ms = SL_READY_TIMEOUT_MS);
+		boolean write(uint8_t* buf, uint16_t len, Priority priority = PRIORITY_NORMAL);
+		boolean read (uint8_t* buf, uint8_t* len, uint8_t* stream = NULL);
 		
 		modemState updateModemState(void);
 		boolean setAntenna(AntennaMode ant);
 		
-	
+		void setPowerMode(PowerMode mode);
+		void scheduleWake(uint32_t delay_ms);
+		boolean isAsleep(void);
+		void setCurrentProfile(uint32_t sleep_uA, uint32_t idle_uA, uint32_t tx_uA);
+		uint32_t getEnergyUsed(void);
+		
+		void setLinkMonitor(uint32_t interval_ms, int16_t rssi_threshold, int8_t snr_threshold);
+		boolean getLinkQuality(LinkQuality* quality);
+		boolean isLinkDegraded(void);
+		boolean canSendBulk(void);
+		
+		void setStatsInterval(uint32_t interval_ms);
+		boolean sampleStats(void);
+		boolean getStats(LinkStats* stats);
+		
+		void setRetryPolicy(uint8_t budget, uint32_t base_ms, uint32_t max_ms);
+		void setTxCallback(TxDoneCallback cb);
+		void setTxHandler(TxDoneHandler handler, void* ctx);
+		boolean isSending(void);
+		
+		void attachJournal(SymphonyLinkJournal* journal);
+		uint16_t pendingUplinks(void);
+		
+		boolean writeLarge(const uint8_t* buf, uint16_t len, boolean reliable = true);
+		boolean isWritingLarge(void);
+		void setFragmentSize(uint8_t frag_size, Priority priority = PRIORITY_BULK);
+		void setReassemblyBuffer(uint8_t* buf, uint16_t size);
+		uint8_t* readLarge(uint16_t* len);
+		
+		void setDutyCycle(uint16_t duty_permille, uint32_t window_ms = SL_DUTY_WINDOW_MS);
+		uint32_t timeOnAir(uint16_t len);
+		uint32_t getAirtimeUsed(void);
+		uint32_t getAirtimeLimit(void);
+		
+		void setClockSyncInterval(uint32_t interval_ms);
+		boolean timeValid(void);
+		uint64_t now(void);
+		int32_t getClockDrift(void);
+		
+		void setDownlinkSequencing(boolean enable);
+		uint32_t getDuplicateCount(void);
+		
+		void setCompression(boolean enable);
+		
+#if defined(__linux__)
+		boolean openTransport(const char* tty);
+		boolean attachIrq(const char* gpio_value_path);
+		int fd(void);
+#endif
+		modemState processReady(void);
+		uint32_t nextDeadline(void);
+		uint32_t pollTimeout(void);
 		
 	private:
 		
+		//Uplink sources in strict priority order.  The journal backlog drains
+		//after live normal traffic and ahead of bulk.
+		enum uplinkSource
+		{
+			SOURCE_HIGH = 0,
+			SOURCE_NORMAL,
+			SOURCE_JOURNAL,
+			SOURCE_BULK,
+			NUM_SOURCES
+		};
+		
+		typedef struct
+		{
+			uint16_t len;
+			uint8_t attempts;
+			uint8_t data[SL_QUEUE_MSG_LEN];
+		} queuedFrame;
+		
+		typedef struct
+		{
+			queuedFrame frames[SL_TX_QUEUE_DEPTH];
+			uint8_t head;
+			uint8_t count;
+		} frameQueue;
+		
+		typedef struct
+		{
+			uint64_t gateway_id;
+			int16_t rssi_avg;	//scaled by 2^SL_LINK_EWMA_SHIFT
+			int16_t snr_avg;	//scaled by 2^SL_LINK_EWMA_SHIFT
+			int16_t rssi_min;
+			int16_t rssi_max;
+			int8_t snr_min;
+			int8_t snr_max;
+			uint16_t samples;
+			uint32_t last_seen;
+		} gatewayStats;
+		
 		modemState _state;
 		uint32_t _net_token;
 		uint8_t _app_token[APP_TOKEN_LEN];
@@ -55,6 +304,77 @@ class SymphonyLink {
 		ll_state _modState;
 		uint32_t _IRQ;
 		
+		PowerMode _powerMode;
+		boolean _asleep;
+		boolean _sleepBlocked;
+		boolean _wakeScheduled;
+		uint32_t _wakeAt;
+		uint32_t _powerTick;
+		uint32_t _sleepCurrent;
+		uint32_t _idleCurrent;
+		uint32_t _txCurrent;
+		uint64_t _charge;		//accumulated uA*ms
+		
+		gatewayStats _gateways[SL_LINK_MAX_GATEWAYS];
+		int8_t _gateway;		//index of the serving gateway, -1 if unknown
+		int8_t _gatewayChannel;
+		boolean _scanning;
+		boolean _linkDegraded;
+		int16_t _lastRssi;
+		uint32_t _linkInterval;
+		uint32_t _linkSampled;
+		int16_t _rssiThreshold;
+		int8_t _snrThreshold;
+		
+		llabs_stats_t _statsPrev;
+		LinkStats _stats;
+		boolean _statsBaseline;
+		boolean _statsValid;
+		uint32_t _statsInterval;
+		uint32_t _statsSampled;
+		
+		uint8_t _txBuf[SL_MAX_TX_LEN];
+		uint16_t _txLen;		//non-zero while a frame is retained
+		uint8_t _txAttempts;
+		uint32_t _txStarted;
+		boolean _txRetryPending;
+		uint32_t _txRetryAt;
+		uint8_t _retryBudget;
+		uint32_t _retryBase;
+		uint32_t _retryMax;
+		TxDoneCallback _txCallback;
+		TxDoneHandler _txHandler;
+		void* _txContext;
+		
+		SymphonyLinkJournal* _journal;
+		boolean _txFromJournal;
+		
+		frameQueue _queues[NUM_PRIORITIES];
+		Priority _txPriority;
+		uint8_t _passed[NUM_SOURCES];	//sends that went ahead of each waiting class
+		
+		FragmentSender _fragTx;
+		FragmentReceiver _fragRx;
+		uint8_t _fragSize;
+		Priority _fragPriority;
+		boolean _largeReady;
+		
+		AirtimeBudget _airtime;
+		LoraParams _radio;
+		boolean _radioValid;
+		
+		NetworkClock _clock;
+		uint32_t _clockInterval;
+		uint32_t _clockSynced;
+		boolean _clockRequested;
+		
+		DownlinkSequencer _sequencer;
+		boolean _sequencing;
+		boolean _compress;
+		
+		int _uartFd;			//host interface of this module, -1 for Serial1
+		int _irqFd;
+		
 		enum ll_rx_state getRxState();
 		enum ll_tx_state getTxState();
 		enum ll_state getModState();
@@ -63,6 +383,32 @@ class SymphonyLink {
 	
 		boolean getIRQ(uint32_t flagsToClear);
 		boolean getState(void);
+		
+		boolean hasPendingWork(void);
+		void accountPower(void);
+		void managePower(void);
+		boolean wake(void);
+		
+		void sampleLink(void);
+		void updateLinkQuality(const llabs_network_info_t* info);
+		void updateStats(const llabs_stats_t* cur, uint32_t elapsed);
+		
+		boolean sendRetained(void);
+		void txFailed(void);
+		void txComplete(boolean success);
+		void serviceUplink(void);
+		int8_t nextUplinkSource(void);
+		boolean enqueue(Priority priority, const uint8_t* buf, uint16_t len, uint8_t attempts, boolean front);
+		boolean dequeue(Priority priority);
+		
+		void serviceFragments(void);
+		boolean handleFragment(const uint8_t* buf, uint8_t len);
+		
+		void loadRadioParams(void);
+		void syncClock(void);
+		
+		void selectTransport(void);
+		uint32_t untilDeadline(uint32_t now, uint32_t at, uint32_t wait);
 
 };
 
@@ -0,0 +1,169 @@
+#include "SymphonyLinkAdr.h"
+
+#define ADR_MAX_DR				(8)
+
+//Uplink data rates only; 0 past the last one
+static const uint8_t adrPayload[NUM_REGIONS][ADR_MAX_DR] =
+{
+	{11, 53, 125, 242, 242, 0, 0, 0},			//US915
+	{51, 51, 51, 115, 222, 222, 222, 222},		//EU868
+	{51, 51, 51, 115, 222, 222, 222, 0},		//AU915
+};
+
+uint8_t adrMaxPayload(LoRaWANRegion region, uint8_t dr)
+{
+	if((region >= NUM_REGIONS) || (dr >= ADR_MAX_DR))
+	{
+		return 0;
+	}
+	return adrPayload[region][dr];
+}
+
+AdrTracker::AdrTracker()
+{
+	_region = REGION_US915;
+	_adr = false;
+	_dr = 0;
+	_accepted = 0;
+	_settleFrom = 0;
+	_changedAt = 0;
+}
+
+void AdrTracker::setRegion(LoRaWANRegion region)
+{
+	_region = (region < NUM_REGIONS) ? region : REGION_US915;
+	_dr = 0;
+	_accepted = 0;
+}
+
+LoRaWANRegion AdrTracker::region(void)
+{
+	return _region;
+}
+
+void AdrTracker::reset(bool adr, uint32_t uplinks, uint32_t now)
+{
+	_adr = adr;
+	_dr = 0;
+	_accepted = 0;
+	_settleFrom = uplinks;
+	_changedAt = now;
+}
+
+bool AdrTracker::adrEnabled(void)
+{
+	return _adr;
+}
+
+uint8_t AdrTracker::dataRate(void)
+{
+	return _dr;
+}
+
+uint8_t AdrTracker::maxPayload(void)
+{
+	return adrMaxPayload(_region, _dr);
+}
+
+uint8_t AdrTracker::largestPayload(void)
+{
+	return adrMaxPayload(_region, maxDataRate());
+}
+
+uint8_t AdrTracker::maxDataRate(void)
+{
+	uint8_t dr = 0;
+
+	while(((dr + 1) < ADR_MAX_DR) && (adrMaxPayload(_region, dr + 1) != 0))
+	{
+		dr++;
+	}
+	return dr;
+}
+
+uint8_t AdrTracker::probePayload(void)
+{
+	uint8_t max = maxPayload();
+	uint8_t dr;
+
+	if(_accepted < ADR_PROBE_UPLINKS)
+	{
+		return max;
+	}
+
+	//The next data rate that carries more, data rates of equal size are
+	//told apart by nothing the module reports
+	for(dr = _dr + 1; dr <= maxDataRate(); dr++)
+	{
+		if(adrMaxPayload(_region, dr) > max)
+		{
+			return adrMaxPayload(_region, dr);
+		}
+	}
+	return max;
+}
+
+bool AdrTracker::converged(uint32_t uplinks, uint32_t now)
+{
+	if(!_adr)
+	{
+		return true;
+	}
+	return ((uplinks - _settleFrom) >= ADR_SETTLE_UPLINKS) ||
+		   ((now - _changedAt) >= ADR_HOLD_MAX_MS);
+}
+
+void AdrTracker::change(uint8_t dr, uint32_t uplinks, uint32_t now)
+{
+	_dr = dr;
+	_accepted = 0;
+	_settleFrom = uplinks;
+	_changedAt = now;
+}
+
+void AdrTracker::accepted(uint8_t len, uint32_t uplinks, uint32_t now)
+{
+	uint8_t dr;
+
+	if(len <= maxPayload())
+	{
+		if(_accepted < 0xFF)
+		{
+			_accepted++;
+		}
+		return;
+	}
+
+	//Sent at a higher data rate than estimated, the lowest one it fits
+	for(dr = _dr + 1; dr <= maxDataRate(); dr++)
+	{
+		if(adrMaxPayload(_region, dr) >= len)
+		{
+			break;
+		}
+	}
+	change((dr <= maxDataRate()) ? dr : maxDataRate(), uplinks, now);
+}
+
+bool AdrTracker::rejected(uint8_t len, uint32_t uplinks, uint32_t now)
+{
+	uint8_t dr = _dr;
+
+	//A failed probe only says the data rate hasn't gone up
+	_accepted = 0;
+	if(len > maxPayload())
+	{
+		return true;
+	}
+
+	//Sent at a lower data rate than estimated, the highest one it exceeds
+	while((dr > 0) && (adrMaxPayload(_region, dr) >= len))
+	{
+		dr--;
+	}
+	if(dr != _dr)
+	{
+		change(dr, uplinks, now);
+	}
+	return maxPayload() < len;
+}
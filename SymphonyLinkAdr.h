@@ -0,0 +1,84 @@
+
+#ifndef SYMPHONYLINKADR_H
+#define SYMPHONYLINKADR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//The network server decides on a data rate from the last 20 or so uplinks;
+//until that many have gone out since the join or the last data rate change
+//ADR is taken to be converging.  Bulk traffic held back for convergence is
+//released after ADR_HOLD_MAX_MS regardless.
+#define ADR_SETTLE_UPLINKS			(20)
+#define ADR_HOLD_MAX_MS				(1800000)
+
+//After this many uplinks accepted at the estimated data rate one frame is
+//sized for the next one up.  A rejected probe costs a NACK, no airtime.
+#define ADR_PROBE_UPLINKS			(4)
+
+enum LoRaWANRegion
+{
+	REGION_US915 = 0,
+	REGION_EU868,
+	REGION_AU915,
+	NUM_REGIONS
+};
+
+//Largest application payload at data rate dr in region, 0 if dr isn't an
+//uplink data rate there (LoRaWAN Regional Parameters, no repeater)
+uint8_t adrMaxPayload(LoRaWANRegion region, uint8_t dr);
+
+/*
+ * Data rate estimate for a LoRaWAN uplink scheduler.
+ *
+ * The module doesn't report the data rate it transmits at, only whether ADR
+ * is enabled, and it refuses a payload that is too long for the current
+ * one.  The estimate starts at the region's lowest data rate on activation
+ * and is moved by what the module accepts and rejects: an accepted payload
+ * longer than the estimate allows raises it, a rejected one lowers it below
+ * that length.  probePayload() periodically offers the next data rate's
+ * size so a data rate raised by ADR is found.
+ */
+class AdrTracker {
+
+	public:
+
+		AdrTracker();
+
+		void setRegion(LoRaWANRegion region);
+		LoRaWANRegion region(void);
+
+		//Start over at the lowest data rate, after a join or an activation
+		void reset(bool adr, uint32_t uplinks, uint32_t now);
+		bool adrEnabled(void);
+
+		uint8_t dataRate(void);
+		uint8_t maxPayload(void);
+		//At the region's fastest data rate
+		uint8_t largestPayload(void);
+		//Size to build the next frame for; above maxPayload() when a probe is due
+		uint8_t probePayload(void);
+
+		//True when ADR is off, or the data rate has held for ADR_SETTLE_UPLINKS
+		//uplinks or ADR_HOLD_MAX_MS
+		bool converged(uint32_t uplinks, uint32_t now);
+
+		//The module took or refused a payload of len bytes.  rejected()
+		//returns false if no smaller size is left to try.
+		void accepted(uint8_t len, uint32_t uplinks, uint32_t now);
+		bool rejected(uint8_t len, uint32_t uplinks, uint32_t now);
+
+	private:
+
+		LoRaWANRegion _region;
+		bool _adr;
+		uint8_t _dr;
+		uint8_t _accepted;			//since the last change or probe
+		uint32_t _settleFrom;		//uplink counter at the last change
+		uint32_t _changedAt;
+
+		uint8_t maxDataRate(void);
+		void change(uint8_t dr, uint32_t uplinks, uint32_t now);
+};
+
+#endif // SYMPHONYLINKADR_H
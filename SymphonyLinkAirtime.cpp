@@ -0,0 +1,190 @@
+#include "SymphonyLinkAirtime.h"
+#include <string.h>
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define AIRTIME_READ_U32(p)		pgm_read_dword(p)
+#define AIRTIME_READ_U8(p)		pgm_read_byte(p)
+#else
+#define AIRTIME_READ_U32(p)		(*(p))
+#define AIRTIME_READ_U8(p)		(*(p))
+#endif
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+#define AIRTIME_SF_MIN			(6)
+#define AIRTIME_SF_MAX			(12)
+#define AIRTIME_NUM_SF			(AIRTIME_SF_MAX - AIRTIME_SF_MIN + 1)
+#define AIRTIME_NUM_BW			(4)
+
+//Low data rate optimisation is mandated once a symbol lasts 16ms or more
+#define AIRTIME_LDRO_US			(16000)
+
+
+//2^SF / BW with BW = 62.5kHz << bw
+static constexpr uint32_t symbolUs(uint8_t sf, uint8_t bw)
+{
+	return (uint32_t)1 << (sf + 4 - bw);
+}
+
+#define SYMBOL_ROW(sf)	{ symbolUs(sf, 0), symbolUs(sf, 1), symbolUs(sf, 2), symbolUs(sf, 3) }
+#define LDRO_ROW(sf)	{ symbolUs(sf, 0) >= AIRTIME_LDRO_US, symbolUs(sf, 1) >= AIRTIME_LDRO_US, \
+						  symbolUs(sf, 2) >= AIRTIME_LDRO_US, symbolUs(sf, 3) >= AIRTIME_LDRO_US }
+
+static constexpr uint32_t symbolTable[AIRTIME_NUM_SF][AIRTIME_NUM_BW] PROGMEM =
+{
+	SYMBOL_ROW(6), SYMBOL_ROW(7), SYMBOL_ROW(8), SYMBOL_ROW(9),
+	SYMBOL_ROW(10), SYMBOL_ROW(11), SYMBOL_ROW(12)
+};
+
+static constexpr uint8_t ldroTable[AIRTIME_NUM_SF][AIRTIME_NUM_BW] PROGMEM =
+{
+	LDRO_ROW(6), LDRO_ROW(7), LDRO_ROW(8), LDRO_ROW(9),
+	LDRO_ROW(10), LDRO_ROW(11), LDRO_ROW(12)
+};
+
+static_assert(symbolUs(7, 1) == 1024, "SF7/125kHz symbol is 1.024ms");
+static_assert(symbolUs(12, 1) == 32768, "SF12/125kHz symbol is 32.768ms");
+
+
+uint32_t airtimeSymbolUs(uint8_t sf, uint8_t bw)
+{
+	if((sf < AIRTIME_SF_MIN) || (sf > AIRTIME_SF_MAX) || (bw >= AIRTIME_NUM_BW))
+	{
+		return 0;
+	}
+	return AIRTIME_READ_U32(&symbolTable[sf - AIRTIME_SF_MIN][bw]);
+}
+
+uint32_t airtimeUs(const LoraParams* params, uint16_t payload_len)
+{
+	uint32_t tsym = airtimeSymbolUs(params->sf, params->bw);
+	int32_t bits;
+	int32_t perBlock;
+	uint32_t symbols = 8;
+
+	if((tsym == 0) || (params->cr < 1) || (params->cr > 4))
+	{
+		return 0;
+	}
+
+	//Payload symbols: 8 + ceil((8PL - 4SF + 28 + 16CRC - 20IH) / 4(SF - 2DE)) * (CR + 4)
+	bits = 8 * (int32_t)payload_len - 4 * params->sf + 28 +
+		   (params->crc_enabled ? 16 : 0) - (params->header_enabled ? 0 : 20);
+	perBlock = 4 * (params->sf - 2 * AIRTIME_READ_U8(&ldroTable[params->sf - AIRTIME_SF_MIN][params->bw]));
+	if(bits > 0)
+	{
+		symbols += (uint32_t)((bits + perBlock - 1) / perBlock) * (params->cr + 4);
+	}
+
+	//Preamble adds 4.25 symbols of sync word and start of frame delimiter
+	return ((uint32_t)params->preamble_syms * 4 + 17) * tsym / 4 + symbols * tsym;
+}
+
+
+AirtimeBudget::AirtimeBudget()
+{
+	configure(0, 0);
+}
+
+void AirtimeBudget::configure(uint32_t window_ms, uint16_t duty_permille)
+{
+	_limit = (uint32_t)(((uint64_t)window_ms * duty_permille) / 1000);
+	_bucketLen = window_ms / AIRTIME_BUCKETS;
+	_bucketStart = 0;
+	_current = 0;
+	memset(_buckets, 0, sizeof(_buckets));
+
+	if(_bucketLen == 0)
+	{
+		_limit = 0;
+	}
+}
+
+bool AirtimeBudget::enabled(void)
+{
+	return (_limit != 0);
+}
+
+uint32_t AirtimeBudget::used(uint32_t now)
+{
+	uint32_t sum = 0;
+	uint8_t i;
+
+	if(!enabled())
+	{
+		return 0;
+	}
+
+	advance(now);
+	for(i = 0; i <= AIRTIME_BUCKETS; i++)
+	{
+		sum += _buckets[i];
+	}
+	return sum;
+}
+
+uint32_t AirtimeBudget::limit(void)
+{
+	return _limit;
+}
+
+uint32_t AirtimeBudget::waitTime(uint32_t airtime_ms, uint32_t now)
+{
+	uint32_t total = used(now);
+	uint8_t i;
+
+	if(!enabled() || (total + airtime_ms <= _limit))
+	{
+		return 0;
+	}
+
+	if(airtime_ms > _limit)
+	{
+		//Never fits, report a full window rather than waiting forever
+		return _bucketLen * AIRTIME_BUCKETS;
+	}
+
+	//Buckets expire oldest first, one per bucket length
+	for(i = 1; i <= AIRTIME_BUCKETS; i++)
+	{
+		total -= _buckets[(_current + i) % (AIRTIME_BUCKETS + 1)];
+		if(total + airtime_ms <= _limit)
+		{
+			return _bucketStart + i * _bucketLen - now;
+		}
+	}
+
+	return _bucketStart + (AIRTIME_BUCKETS + 1) * _bucketLen - now;
+}
+
+void AirtimeBudget::record(uint32_t airtime_ms, uint32_t now)
+{
+	if(!enabled())
+	{
+		return;
+	}
+
+	advance(now);
+	_buckets[_current] += airtime_ms;
+}
+
+void AirtimeBudget::advance(uint32_t now)
+{
+	if((now - _bucketStart) >= (AIRTIME_BUCKETS + 1) * _bucketLen)
+	{
+		//Idle for longer than the window, everything has expired
+		memset(_buckets, 0, sizeof(_buckets));
+		_bucketStart = now;
+		return;
+	}
+
+	while((now - _bucketStart) >= _bucketLen)
+	{
+		_current = (_current + 1) % (AIRTIME_BUCKETS + 1);
+		_buckets[_current] = 0;
+		_bucketStart += _bucketLen;
+	}
+}
@@ -0,0 +1,73 @@
+
+#ifndef SYMPHONYLINKAIRTIME_H
+#define SYMPHONYLINKAIRTIME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Airtime budget granularity.  The window is tracked in this many buckets;
+//more buckets follow the true rolling window more closely.
+#ifndef AIRTIME_BUCKETS
+#if defined(__AVR__)
+#define AIRTIME_BUCKETS			(6)
+#else
+#define AIRTIME_BUCKETS			(24)
+#endif
+#endif
+
+//LoRa modulation settings, encoded as returned by ll_radio_params_get
+typedef struct
+{
+	uint8_t sf;					//6..12
+	uint8_t cr;					//1=CR4/5 ... 4=CR4/8
+	uint8_t bw;					//0=62.5kHz ... 3=500kHz
+	uint16_t preamble_syms;
+	uint8_t header_enabled;
+	uint8_t crc_enabled;
+} LoraParams;
+
+//Symbol duration in microseconds, 2^SF / BW
+uint32_t airtimeSymbolUs(uint8_t sf, uint8_t bw);
+
+//Time on air of a LoRa frame in microseconds (Semtech AN1200.13), 0 if the
+//parameters are out of range
+uint32_t airtimeUs(const LoraParams* params, uint16_t payload_len);
+
+/*
+ * Rolling-window airtime accountant for regulatory duty-cycle limits.
+ *
+ * Airtime is summed per bucket of window/AIRTIME_BUCKETS.  A bucket is only
+ * forgotten once all of it is older than the window, so the estimate never
+ * undercounts and a sender that keeps waitTime() at zero cannot exceed the
+ * limit, while still being allowed to use all of it.
+ */
+class AirtimeBudget {
+
+	public:
+
+		AirtimeBudget();
+
+		//Allow duty_permille/1000 of window_ms on air, 0 disables the budget
+		void configure(uint32_t window_ms, uint16_t duty_permille);
+		bool enabled(void);
+
+		//Airtime used and allowed within the window (ms)
+		uint32_t used(uint32_t now);
+		uint32_t limit(void);
+
+		//Milliseconds until a frame of airtime_ms fits the budget, 0 if it fits now
+		uint32_t waitTime(uint32_t airtime_ms, uint32_t now);
+		void record(uint32_t airtime_ms, uint32_t now);
+
+	private:
+
+		uint32_t _limit;
+		uint32_t _bucketLen;
+		uint32_t _bucketStart;		//start of the current bucket
+		uint8_t _current;
+		uint32_t _buckets[AIRTIME_BUCKETS + 1];
+
+		void advance(uint32_t now);
+};
+
+#endif // SYMPHONYLINKAIRTIME_H
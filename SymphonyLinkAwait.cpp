@@ -0,0 +1,436 @@
+#include "SymphonyLinkAwait.h"
+
+#if defined(__linux__) && defined(__cpp_impl_coroutine)
+
+#include <exception>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+
+void LinkTask::promise_type::unhandled_exception(void)
+{
+	//A flow has nobody to report to
+	std::terminate();
+}
+
+LinkWaiter::LinkWaiter(AsyncLink* link, WaitKind kind, uint32_t timeout_ms)
+{
+	_next = NULL;
+	_link = link;
+	_kind = kind;
+	_timeout = timeout_ms;
+	_deadline = 0;
+
+	_txBuf = NULL;
+	_txLen = 0;
+	_priority = PRIORITY_NORMAL;
+
+	_rxBuf = NULL;
+	_rxLen = NULL;
+	_stream = NULL;
+
+	_target = INIT;
+	_anyChange = false;
+	_state = link->_lastState;
+
+	_result = false;
+}
+
+void LinkWaiter::suspend(std::coroutine_handle<> handle)
+{
+	_handle = handle;
+	_deadline = millis() + _timeout;
+	_link->add(this);
+}
+
+bool LinkOp::await_ready(void)
+{
+	//Nothing to wait for
+	if((_kind == WAIT_SLEEP) && (_timeout == 0))
+	{
+		_result = true;
+		return true;
+	}
+	return false;
+}
+
+bool StateOp::await_ready(void)
+{
+	if(!_anyChange && (_link->_lastState == _target))
+	{
+		_state = _target;
+		return true;
+	}
+	return false;
+}
+
+
+
+AsyncLink::AsyncLink(SymphonyLink* link)
+{
+	_link = link;
+	_head = NULL;
+	_tail = NULL;
+	_inflight = NULL;
+	_txDone = false;
+	_txSuccess = false;
+	_lastState = INIT;
+
+	_link->setTxHandler(txDone, this);
+}
+
+SymphonyLink* AsyncLink::link(void)
+{
+	return _link;
+}
+
+LinkOp AsyncLink::send(const uint8_t* buf, uint16_t len, Priority priority)
+{
+	LinkOp op(this, WAIT_SEND, 0);
+
+	op._txBuf = buf;
+	op._txLen = len;
+	op._priority = priority;
+	return op;
+}
+
+LinkOp AsyncLink::receive(uint8_t* buf, uint8_t* len, uint32_t timeout_ms, uint8_t* stream)
+{
+	LinkOp op(this, WAIT_RECEIVE, timeout_ms);
+
+	op._rxBuf = buf;
+	op._rxLen = len;
+	op._stream = stream;
+	return op;
+}
+
+StateOp AsyncLink::state(modemState target, uint32_t timeout_ms)
+{
+	StateOp op(this, timeout_ms);
+
+	op._target = target;
+	return op;
+}
+
+StateOp AsyncLink::state(void)
+{
+	StateOp op(this, 0);
+
+	op._anyChange = true;
+	return op;
+}
+
+LinkOp AsyncLink::sleep(uint32_t ms)
+{
+	return LinkOp(this, WAIT_SLEEP, ms);
+}
+
+boolean AsyncLink::idle(void)
+{
+	return (_head == NULL) && (_inflight == NULL);
+}
+
+void AsyncLink::add(LinkWaiter* w)
+{
+	w->_next = NULL;
+	if(_tail == NULL)
+	{
+		_head = w;
+	}
+	else
+	{
+		_tail->_next = w;
+	}
+	_tail = w;
+}
+
+void AsyncLink::remove(LinkWaiter* w, LinkWaiter* prev)
+{
+	if(prev == NULL)
+	{
+		_head = w->_next;
+	}
+	else
+	{
+		prev->_next = w->_next;
+	}
+	if(_tail == w)
+	{
+		_tail = prev;
+	}
+	w->_next = NULL;
+}
+
+void AsyncLink::txDone(void* ctx, const uint8_t* buf, uint16_t len, boolean success)
+{
+	AsyncLink* self = (AsyncLink*)ctx;
+
+	(void)buf;
+	(void)len;
+
+	//Resumed from process(), not from inside the state machine
+	if(self->_inflight != NULL)
+	{
+		self->_txDone = true;
+		self->_txSuccess = success;
+	}
+}
+
+boolean AsyncLink::canSend(void)
+{
+	//Only write when the frame goes out on its own, so the next completion
+	//reported by the link is this one
+	if((_inflight != NULL) || (_lastState != READ_TO_SEND) ||
+	   (_link->pendingUplinks() != 0) || _link->isWritingLarge())
+	{
+		return false;
+	}
+	return true;
+}
+
+boolean AsyncLink::ready(LinkWaiter* w, uint32_t now)
+{
+	boolean expired = (w->_timeout != 0) && ((int32_t)(now - w->_deadline) >= 0);
+
+	switch(w->_kind)
+	{
+		case WAIT_STATE:
+			if(w->_anyChange ? (_lastState != w->_state) : (_lastState == w->_target))
+			{
+				w->_state = _lastState;
+				return true;
+			}
+			w->_state = _lastState;
+			return expired;
+
+		case WAIT_SLEEP:
+			w->_result = true;
+			return expired;
+
+		case WAIT_RECEIVE:
+			w->_result = false;
+			return expired;
+
+		default:
+			return false;
+	}
+}
+
+void AsyncLink::process(void)
+{
+	LinkWaiter* w;
+	LinkWaiter* prev;
+	boolean polled = false;
+	boolean resume;
+	uint32_t now;
+
+	_lastState = _link->processReady();
+
+	for(;;)
+	{
+		if(_txDone)
+		{
+			w = _inflight;
+			_inflight = NULL;
+			_txDone = false;
+			w->_result = _txSuccess;
+			w->_handle.resume();
+			continue;
+		}
+
+		now = millis();
+		resume = false;
+		for(prev = NULL, w = _head; w != NULL; prev = w, w = w->_next)
+		{
+			if(w->_kind == WAIT_SEND)
+			{
+				if(!canSend())
+				{
+					continue;
+				}
+				remove(w, prev);
+				if(_link->write((uint8_t*)w->_txBuf, w->_txLen, w->_priority))
+				{
+					_inflight = w;
+					break;
+				}
+				w->_result = false;
+				resume = true;
+				break;
+			}
+
+			//One read per pass, a retrieved message is gone until the
+			//module's state is read again
+			if((w->_kind == WAIT_RECEIVE) && !polled)
+			{
+				polled = true;
+				if(_link->read(w->_rxBuf, w->_rxLen, w->_stream))
+				{
+					w->_result = true;
+					remove(w, prev);
+					resume = true;
+					break;
+				}
+			}
+
+			if(ready(w, now))
+			{
+				remove(w, prev);
+				resume = true;
+				break;
+			}
+		}
+
+		if(w == NULL)
+		{
+			break;
+		}
+		if(resume)
+		{
+			w->_handle.resume();
+		}
+	}
+}
+
+uint32_t AsyncLink::pollTimeout(void)
+{
+	uint32_t now = millis();
+	uint32_t wait = _link->pollTimeout();
+	int32_t remaining;
+	LinkWaiter* w;
+
+	if(_txDone)
+	{
+		return 0;
+	}
+
+	for(w = _head; w != NULL; w = w->_next)
+	{
+		if((w->_kind == WAIT_SEND) && canSend())
+		{
+			return 0;
+		}
+		if(w->_timeout != 0)
+		{
+			remaining = (int32_t)(w->_deadline - now);
+			if(remaining <= 0)
+			{
+				return 0;
+			}
+			if((uint32_t)remaining < wait)
+			{
+				wait = remaining;
+			}
+		}
+	}
+	return wait;
+}
+
+
+
+AsyncLoop::AsyncLoop()
+{
+	_epfd = epoll_create1(EPOLL_CLOEXEC);
+	_count = 0;
+	_stopped = false;
+}
+
+AsyncLoop::~AsyncLoop()
+{
+	if(_epfd >= 0)
+	{
+		close(_epfd);
+	}
+}
+
+boolean AsyncLoop::add(AsyncLink* link)
+{
+	struct epoll_event ev;
+	int fd = link->link()->fd();
+
+	if((_epfd < 0) || (_count >= AWAIT_MAX_LINKS))
+	{
+		return false;
+	}
+
+	//Links without an IRQ line run on their poll timeout alone
+	if(fd >= 0)
+	{
+		ev.events = EPOLLPRI | EPOLLERR;
+		ev.data.u32 = _count;
+		if(epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		{
+			return false;
+		}
+	}
+
+	_links[_count++] = link;
+	return true;
+}
+
+boolean AsyncLoop::runOnce(void)
+{
+	struct epoll_event events[AWAIT_MAX_LINKS];
+	uint32_t due[AWAIT_MAX_LINKS];
+	boolean fired[AWAIT_MAX_LINKS];
+	uint32_t now = millis();
+	uint32_t wait = SL_IDLE_DEADLINE_MS;
+	uint32_t t;
+	int n;
+	int i;
+
+	for(i = 0; i < _count; i++)
+	{
+		t = _links[i]->pollTimeout();
+		due[i] = now + t;
+		fired[i] = false;
+		if(t < wait)
+		{
+			wait = t;
+		}
+	}
+
+	n = epoll_wait(_epfd, events, AWAIT_MAX_LINKS, (int)wait);
+	if(n < 0)
+	{
+		return false;
+	}
+	for(i = 0; i < n; i++)
+	{
+		fired[events[i].data.u32] = true;
+	}
+
+	now = millis();
+	for(i = 0; i < _count; i++)
+	{
+		if(fired[i] || ((int32_t)(now - due[i]) >= 0))
+		{
+			_links[i]->process();
+		}
+	}
+	return true;
+}
+
+void AsyncLoop::run(void)
+{
+	uint8_t i;
+
+	_stopped = false;
+	while(!_stopped)
+	{
+		for(i = 0; (i < _count) && _links[i]->idle(); i++)
+		{
+		}
+		if((i == _count) || !runOnce())
+		{
+			return;
+		}
+	}
+}
+
+void AsyncLoop::stop(void)
+{
+	_stopped = true;
+}
+
+#endif
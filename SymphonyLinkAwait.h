@@ -0,0 +1,207 @@
+
+#ifndef SYMPHONYLINKAWAIT_H
+#define SYMPHONYLINKAWAIT_H
+
+#include "SymphonyLink.h"
+
+#if defined(__linux__) && defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+
+//Links one AsyncLoop serves
+#define AWAIT_MAX_LINKS			(16)
+
+/*
+ * C++20 coroutine facade for Linux gateways.
+ *
+ * An AsyncLink wraps a SymphonyLink and hands out awaitables:
+ *
+ *   LinkTask report(AsyncLink& link)
+ *   {
+ *       co_await link.state(READ_TO_SEND);
+ *       if(!co_await link.send(buf, len))
+ *           ...
+ *       co_await link.sleep(60000);
+ *   }
+ *
+ * A suspended flow is resumed from process(), which advances the module with
+ * SymphonyLink::processReady() and then wakes every waiter whose condition
+ * holds.  AsyncLoop runs process() for several links off one epoll set, using
+ * each module's IRQ descriptor and pollTimeout() as the epoll timeout.
+ *
+ * Uplinks from all flows of a link are written one at a time, each once the
+ * previous one has completed, so a send resumes with that frame's own
+ * outcome.  The AsyncLink owns the instance's uplink path and tx handler;
+ * don't write() to the SymphonyLink directly while flows are running.
+ * Downlinks go to the receive waiters in the order they started waiting.
+ *
+ * Awaitables live in the suspended coroutine's frame, no memory is allocated
+ * besides the frames themselves.
+ *
+ * A flow suspends on link events (state changes, send outcomes, downlinks,
+ * timers), not on single host interface transactions: process() still makes
+ * the module's ll_ifc calls synchronously, a few bounded UART round trips
+ * per pass (see SymphonyLink.h).  Every link served by one AsyncLoop waits
+ * for those, so put links whose latency matters on a loop of their own.
+ */
+
+class AsyncLink;
+
+//Fire and forget coroutine, runs until its first suspension when called
+struct LinkTask
+{
+	struct promise_type
+	{
+		LinkTask get_return_object(void) { return LinkTask(); }
+		std::suspend_never initial_suspend(void) noexcept { return {}; }
+		std::suspend_never final_suspend(void) noexcept { return {}; }
+		void return_void(void) {}
+		void unhandled_exception(void);
+	};
+};
+
+enum WaitKind
+{
+	WAIT_SEND = 0,
+	WAIT_RECEIVE,
+	WAIT_STATE,
+	WAIT_SLEEP
+};
+
+class LinkWaiter {
+
+	friend class AsyncLink;
+
+	protected:
+
+		LinkWaiter(AsyncLink* link, WaitKind kind, uint32_t timeout_ms);
+
+		void suspend(std::coroutine_handle<> handle);
+
+		LinkWaiter* _next;
+		AsyncLink* _link;
+		std::coroutine_handle<> _handle;
+		WaitKind _kind;
+		uint32_t _timeout;			//0 waits indefinitely
+		uint32_t _deadline;
+
+		const uint8_t* _txBuf;
+		uint16_t _txLen;
+		Priority _priority;
+
+		uint8_t* _rxBuf;
+		uint8_t* _rxLen;
+		uint8_t* _stream;
+
+		modemState _target;
+		boolean _anyChange;			//next change instead of a given state
+		modemState _state;
+
+		boolean _result;
+};
+
+//Resumes with true on success, false on failure or timeout
+class LinkOp : public LinkWaiter {
+
+	friend class AsyncLink;
+
+	public:
+
+		bool await_ready(void);
+		void await_suspend(std::coroutine_handle<> handle) { suspend(handle); }
+		bool await_resume(void) { return _result; }
+
+	private:
+
+		LinkOp(AsyncLink* link, WaitKind kind, uint32_t timeout_ms) : LinkWaiter(link, kind, timeout_ms) {}
+};
+
+//Resumes with the state reached, the current one on timeout
+class StateOp : public LinkWaiter {
+
+	friend class AsyncLink;
+
+	public:
+
+		bool await_ready(void);
+		void await_suspend(std::coroutine_handle<> handle) { suspend(handle); }
+		modemState await_resume(void) { return _state; }
+
+	private:
+
+		StateOp(AsyncLink* link, uint32_t timeout_ms) : LinkWaiter(link, WAIT_STATE, timeout_ms) {}
+};
+
+class AsyncLink {
+
+	friend class LinkWaiter;
+	friend class LinkOp;
+	friend class StateOp;
+
+	public:
+
+		AsyncLink(SymphonyLink* link);
+
+		//Written once all earlier sends of this link have completed;
+		//buf must stay valid until the send resumes
+		LinkOp send(const uint8_t* buf, uint16_t len, Priority priority = PRIORITY_NORMAL);
+
+		//*len is the buffer size on entry, as for SymphonyLink::read()
+		LinkOp receive(uint8_t* buf, uint8_t* len, uint32_t timeout_ms = 0, uint8_t* stream = NULL);
+
+		StateOp state(modemState target, uint32_t timeout_ms = 0);
+		StateOp state(void);			//next state change
+		LinkOp sleep(uint32_t ms);
+
+		//Advance the module and resume the flows that can continue
+		void process(void);
+		uint32_t pollTimeout(void);
+		boolean idle(void);				//no flow waiting on this link
+
+		SymphonyLink* link(void);
+
+	private:
+
+		SymphonyLink* _link;
+		LinkWaiter* _head;			//waiters in arrival order
+		LinkWaiter* _tail;
+		LinkWaiter* _inflight;		//send written, completion pending
+		boolean _txDone;
+		boolean _txSuccess;
+		modemState _lastState;
+
+		void add(LinkWaiter* w);
+		void remove(LinkWaiter* w, LinkWaiter* prev);
+		boolean ready(LinkWaiter* w, uint32_t now);
+		boolean canSend(void);
+
+		static void txDone(void* ctx, const uint8_t* buf, uint16_t len, boolean success);
+};
+
+class AsyncLoop {
+
+	public:
+
+		AsyncLoop();
+		~AsyncLoop();
+
+		boolean add(AsyncLink* link);
+
+		//One epoll_wait and the processing after it
+		boolean runOnce(void);
+
+		//Until stop() or every link is idle
+		void run(void);
+		void stop(void);
+
+	private:
+
+		int _epfd;
+		AsyncLink* _links[AWAIT_MAX_LINKS];
+		uint8_t _count;
+		boolean _stopped;
+};
+
+#endif
+
+#endif // SYMPHONYLINKAWAIT_H
@@ -0,0 +1,146 @@
+#include "SymphonyLinkClock.h"
+#include "ll_ifc_symphony.h"
+
+#if defined(__linux__)
+#include <time.h>
+#else
+#include "arduino.h"
+#endif
+
+
+NetworkClock::NetworkClock()
+{
+	_valid = false;
+	_driftValid = false;
+	_anchorLocal = 0;
+	_anchorNet = 0;
+	_baseLocal = 0;
+	_baseNet = 0;
+	_moduleSync = 0;
+	_drift = 0;
+	_last = 0;
+	_wrapLast = 0;
+	_wrapHigh = 0;
+}
+
+bool NetworkClock::sync(void)
+{
+	llabs_time_info_t info;
+	uint64_t before;
+	uint64_t after;
+	uint64_t local;
+	uint64_t net;
+	int64_t elapsed;
+	int64_t error;
+	int32_t measured;
+
+	before = localMicros();
+	if(0 > ll_system_time_get(&info))
+	{
+		return false;
+	}
+	after = localMicros();
+
+	//The module has never heard the network time
+	if(info.last_sync.seconds == 0)
+	{
+		return false;
+	}
+
+	//The module time was read somewhere in the round trip and truncated to 1ms
+	local = before + (after - before) / 2;
+	net = (uint64_t)info.curr.seconds * 1000000000ULL + (uint64_t)info.curr.millis * 1000000ULL + 500000ULL;
+
+	if(!_valid || (info.last_sync.seconds != _moduleSync))
+	{
+		//First sync, or the module stepped its clock: start a new baseline
+		_baseLocal = local;
+		_baseNet = net;
+		_moduleSync = info.last_sync.seconds;
+	}
+	else if((local - _baseLocal) >= (uint64_t)CLOCK_DRIFT_MIN_INTERVAL_MS * 1000)
+	{
+		elapsed = (int64_t)(local - _baseLocal);
+		error = (int64_t)(net - _baseNet) - elapsed * 1000;
+		measured = (int32_t)((error * 1000000) / elapsed);
+
+		if((measured <= CLOCK_MAX_DRIFT_PPB) && (measured >= -CLOCK_MAX_DRIFT_PPB))
+		{
+			if(_driftValid)
+			{
+				_drift += (measured - _drift) / (1 << CLOCK_DRIFT_EWMA_SHIFT);
+			}
+			else
+			{
+				_drift = measured;
+				_driftValid = true;
+			}
+		}
+
+		_baseLocal = local;
+		_baseNet = net;
+	}
+
+	_anchorLocal = local;
+	_anchorNet = net;
+	_valid = true;
+	return true;
+}
+
+bool NetworkClock::requestSync(bool opportunistic)
+{
+	return (0 <= ll_system_time_sync(opportunistic ? 1 : 0));
+}
+
+bool NetworkClock::valid(void)
+{
+	return _valid;
+}
+
+uint64_t NetworkClock::now(void)
+{
+	int64_t elapsed;
+	uint64_t t;
+
+	if(!_valid)
+	{
+		localMicros();
+		return 0;
+	}
+
+	elapsed = (int64_t)(localMicros() - _anchorLocal);
+	t = _anchorNet + (uint64_t)(elapsed * 1000 + (elapsed * _drift) / 1000000);
+
+	//Never step backwards when a sync pulls the clock in
+	if(t < _last)
+	{
+		t = _last;
+	}
+	_last = t;
+	return t;
+}
+
+int32_t NetworkClock::driftPpb(void)
+{
+	return _drift;
+}
+
+uint64_t NetworkClock::localMicros(void)
+{
+#if defined(__linux__)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+#else
+	uint32_t us = micros();
+
+	//Extend micros() past its 32 bit wrap
+	if(us < _wrapLast)
+	{
+		_wrapHigh++;
+	}
+	_wrapLast = us;
+	return ((uint64_t)_wrapHigh << 32) | us;
+#endif
+}
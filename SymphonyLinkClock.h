@@ -0,0 +1,65 @@
+
+#ifndef SYMPHONYLINKCLOCK_H
+#define SYMPHONYLINKCLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Syncs closer together than this only re-anchor the clock; the drift
+//estimate needs a long baseline to beat the module's 1ms time resolution
+#define CLOCK_DRIFT_MIN_INTERVAL_MS	(60000)
+
+//Drift estimates beyond this are treated as measurement errors
+#define CLOCK_MAX_DRIFT_PPB			(500000)
+
+//EWMA weight of a new drift measurement, 1/(2^CLOCK_DRIFT_EWMA_SHIFT)
+#define CLOCK_DRIFT_EWMA_SHIFT		(2)
+
+/*
+ * Host clock disciplined by the module's network time.
+ *
+ * sync() reads the module's time with ll_system_time_get and pairs it with
+ * the local clock at the midpoint of the round trip.  Successive syncs give
+ * the host clock's drift against network time.  now() is then answered from
+ * the local clock alone: CLOCK_MONOTONIC on Linux, micros() elsewhere.
+ * micros() wraps every ~71 minutes, so now() or sync() must run at least that
+ * often to keep the extended count right.
+ */
+class NetworkClock {
+
+	public:
+
+		NetworkClock();
+
+		//One round trip to the module, false if it has no network time yet
+		bool sync(void);
+
+		//Ask the module to refresh its time from the gateway
+		bool requestSync(bool opportunistic);
+
+		bool valid(void);
+
+		//Nanoseconds since the UNIX epoch, 0 until the first successful sync
+		uint64_t now(void);
+
+		//Estimated host clock error in parts per billion, positive when it runs slow
+		int32_t driftPpb(void);
+
+	private:
+
+		bool _valid;
+		bool _driftValid;
+		uint64_t _anchorLocal;		//local us at the anchor
+		uint64_t _anchorNet;		//network ns at the anchor
+		uint64_t _baseLocal;		//start of the current drift baseline
+		uint64_t _baseNet;
+		uint32_t _moduleSync;		//module's last_sync seconds at the baseline
+		int32_t _drift;
+		uint64_t _last;				//last value returned by now()
+		uint32_t _wrapLast;
+		uint32_t _wrapHigh;
+
+		uint64_t localMicros(void);
+};
+
+#endif // SYMPHONYLINKCLOCK_H
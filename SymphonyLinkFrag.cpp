@@ -0,0 +1,356 @@
+#include "SymphonyLinkFrag.h"
+#include <string.h>
+
+
+static bool bitGet(const uint8_t* bitmap, uint8_t i)
+{
+	return (bitmap[i >> 3] & (1 << (i & 7))) != 0;
+}
+
+static void bitSet(uint8_t* bitmap, uint8_t i)
+{
+	bitmap[i >> 3] |= (uint8_t)(1 << (i & 7));
+}
+
+
+FragmentSender::FragmentSender()
+{
+	_buf = NULL;
+	_len = 0;
+	_fragSize = 0;
+	_count = 0;
+	_id = 0;
+	_cursor = 0;
+	_rounds = 0;
+	_active = false;
+	_reliable = false;
+	_awaitingAck = false;
+	_sentAt = 0;
+	memset(_pending, 0, sizeof(_pending));
+}
+
+bool FragmentSender::start(const uint8_t* buf, uint16_t len, uint8_t frag_size, bool reliable)
+{
+	uint16_t count;
+	uint16_t i;
+
+	if(_active || (buf == NULL) || (len == 0) || (frag_size == 0))
+	{
+		return false;
+	}
+
+	count = (len + frag_size - 1) / frag_size;
+	if(count > FRAG_MAX_FRAGMENTS)
+	{
+		return false;
+	}
+
+	_buf = buf;
+	_len = len;
+	_fragSize = frag_size;
+	_count = (uint8_t)count;
+	_id++;
+	_cursor = 0;
+	_rounds = 0;
+	_reliable = reliable;
+	_awaitingAck = false;
+	_active = true;
+
+	memset(_pending, 0, sizeof(_pending));
+	for(i = 0; i < count; i++)
+	{
+		bitSet(_pending, (uint8_t)i);
+	}
+	return true;
+}
+
+void FragmentSender::cancel(void)
+{
+	_active = false;
+	_buf = NULL;
+}
+
+bool FragmentSender::busy(void)
+{
+	return _active;
+}
+
+uint16_t FragmentSender::next(uint8_t* out, uint16_t out_len, uint32_t now)
+{
+	uint16_t idx;
+	uint16_t more;
+	uint16_t offset;
+	uint16_t chunk;
+
+	if(!_active || _awaitingAck)
+	{
+		return 0;
+	}
+
+	//Next fragment still missing at the receiver in this round
+	for(idx = _cursor; (idx < _count) && !bitGet(_pending, (uint8_t)idx); idx++)
+	{
+	}
+
+	if(idx >= _count)
+	{
+		return 0;
+	}
+
+	for(more = idx + 1; (more < _count) && !bitGet(_pending, (uint8_t)more); more++)
+	{
+	}
+
+	offset = idx * _fragSize;
+	chunk = ((_len - offset) < _fragSize) ? (_len - offset) : _fragSize;
+	if(out_len < FRAG_HEADER_LEN + chunk)
+	{
+		return 0;
+	}
+
+	//The last fragment of a round asks the receiver which fragments it holds
+	out[0] = FRAG_MARKER | (((more >= _count) && _reliable) ? FRAG_DATA_ACK_REQ : FRAG_DATA);
+	out[1] = _id;
+	out[2] = (uint8_t)idx;
+	out[3] = _count;
+	out[4] = _fragSize;
+	memcpy(out + FRAG_HEADER_LEN, _buf + offset, chunk);
+
+	_cursor = (uint8_t)(idx + 1);
+
+	if(more >= _count)
+	{
+		if(_reliable)
+		{
+			_awaitingAck = true;
+			_sentAt = now;
+		}
+		else
+		{
+			_active = false;
+		}
+	}
+
+	return FRAG_HEADER_LEN + chunk;
+}
+
+FragResult FragmentSender::handleAck(const uint8_t* frame, uint16_t len)
+{
+	uint16_t i;
+	bool missing = false;
+
+	if((len < FRAG_ACK_HEADER_LEN) || (frame[0] != (FRAG_MARKER | FRAG_ACK)))
+	{
+		return FRAG_NONE;
+	}
+
+	if(!_active || (frame[1] != _id) || (frame[2] != _count) ||
+	   (len < FRAG_ACK_HEADER_LEN + ((_count + 7) / 8)))
+	{
+		return FRAG_ERROR;
+	}
+
+	for(i = 0; i < _count; i++)
+	{
+		if(bitGet(frame + FRAG_ACK_HEADER_LEN, (uint8_t)i))
+		{
+			_pending[i >> 3] &= (uint8_t)~(1 << (i & 7));
+		}
+		else if(bitGet(_pending, (uint8_t)i))
+		{
+			missing = true;
+		}
+	}
+
+	if(!missing)
+	{
+		_active = false;
+		return FRAG_COMPLETE;
+	}
+
+	//Start a new round with just the missing fragments
+	_cursor = 0;
+	_rounds = 0;
+	_awaitingAck = false;
+	return FRAG_PENDING;
+}
+
+FragResult FragmentSender::poll(uint32_t now, uint32_t ack_timeout_ms)
+{
+	if(!_active || !_awaitingAck || ((now - _sentAt) < ack_timeout_ms))
+	{
+		return FRAG_PENDING;
+	}
+
+	if(++_rounds >= FRAG_MAX_ROUNDS)
+	{
+		_active = false;
+		return FRAG_ERROR;
+	}
+
+	_cursor = 0;
+	_awaitingAck = false;
+	return FRAG_PENDING;
+}
+
+bool FragmentSender::awaitingAck(void)
+{
+	return _active && _awaitingAck;
+}
+
+uint32_t FragmentSender::ackSentAt(void)
+{
+	return _sentAt;
+}
+
+
+FragmentReceiver::FragmentReceiver()
+{
+	_buf = NULL;
+	_size = 0;
+	_len = 0;
+	_maxCount = FRAG_MAX_FRAGMENTS;
+	_id = 0;
+	_count = 0;
+	_fragSize = 0;
+	_received = 0;
+	_active = false;
+	_complete = false;
+	_ackNeeded = false;
+	_lastRx = 0;
+	memset(_bitmap, 0, sizeof(_bitmap));
+}
+
+void FragmentReceiver::begin(uint8_t* buf, uint16_t size, uint8_t max_count)
+{
+	_buf = buf;
+	_size = size;
+	_maxCount = max_count;
+	_active = false;
+	_complete = false;
+}
+
+bool FragmentReceiver::enabled(void)
+{
+	return (_buf != NULL);
+}
+
+FragResult FragmentReceiver::push(const uint8_t* frame, uint16_t len, uint32_t now)
+{
+	uint8_t type;
+	uint8_t idx;
+	uint16_t offset;
+	uint16_t chunk;
+
+	_ackNeeded = false;
+
+	if((len < FRAG_HEADER_LEN) || ((frame[0] & FRAG_MARKER_MASK) != FRAG_MARKER))
+	{
+		return FRAG_NONE;
+	}
+
+	type = frame[0] & ~FRAG_MARKER_MASK;
+	if((type != FRAG_DATA) && (type != FRAG_DATA_ACK_REQ))
+	{
+		return FRAG_NONE;
+	}
+
+	idx = frame[2];
+	chunk = len - FRAG_HEADER_LEN;
+	if((_buf == NULL) || (frame[3] == 0) || (frame[3] > _maxCount) || (idx >= frame[3]) || (frame[4] == 0) ||
+	   (chunk > frame[4]) || ((idx + 1 < frame[3]) && (chunk != frame[4])))
+	{
+		return FRAG_ERROR;
+	}
+
+	//A retransmission of the transfer we just delivered only needs a fresh ack
+	if(_complete && (frame[1] == _id))
+	{
+		_ackNeeded = true;
+		return FRAG_PENDING;
+	}
+
+	if(!_active || (frame[1] != _id) || (frame[3] != _count) || (frame[4] != _fragSize))
+	{
+		_id = frame[1];
+		_count = frame[3];
+		_fragSize = frame[4];
+		_received = 0;
+		_len = 0;
+		_active = true;
+		_complete = false;
+		memset(_bitmap, 0, sizeof(_bitmap));
+	}
+
+	offset = (uint16_t)idx * _fragSize;
+	if(offset + chunk > _size)
+	{
+		_active = false;
+		return FRAG_ERROR;
+	}
+
+	_lastRx = now;
+
+	if(!bitGet(_bitmap, idx))
+	{
+		memcpy(_buf + offset, frame + FRAG_HEADER_LEN, chunk);
+		bitSet(_bitmap, idx);
+		_received++;
+		if(idx + 1 == _count)
+		{
+			_len = offset + chunk;
+		}
+	}
+
+	if(_received == _count)
+	{
+		_active = false;
+		_complete = true;
+		_ackNeeded = true;
+		return FRAG_COMPLETE;
+	}
+
+	_ackNeeded = (type == FRAG_DATA_ACK_REQ);
+	return FRAG_PENDING;
+}
+
+bool FragmentReceiver::ackNeeded(void)
+{
+	return _ackNeeded;
+}
+
+uint16_t FragmentReceiver::buildAck(uint8_t* out, uint16_t out_len)
+{
+	uint16_t bitmapLen = (_count + 7) / 8;
+
+	if(out_len < FRAG_ACK_HEADER_LEN + bitmapLen)
+	{
+		return 0;
+	}
+
+	out[0] = FRAG_MARKER | FRAG_ACK;
+	out[1] = _id;
+	out[2] = _count;
+	memcpy(out + FRAG_ACK_HEADER_LEN, _bitmap, bitmapLen);
+
+	_ackNeeded = false;
+	return FRAG_ACK_HEADER_LEN + bitmapLen;
+}
+
+void FragmentReceiver::poll(uint32_t now, uint32_t timeout_ms)
+{
+	if(_active && ((now - _lastRx) >= timeout_ms))
+	{
+		_active = false;
+	}
+}
+
+uint16_t FragmentReceiver::length(void)
+{
+	return _complete ? _len : 0;
+}
+
+uint8_t* FragmentReceiver::data(void)
+{
+	return _buf;
+}
@@ -0,0 +1,133 @@
+
+#ifndef SYMPHONYLINKFRAG_H
+#define SYMPHONYLINKFRAG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Application level fragmentation for payloads larger than one frame.
+ *
+ * Every fragment starts with a 5 byte header:
+ *   [0] FRAG_MARKER | type
+ *   [1] transfer id
+ *   [2] fragment index
+ *   [3] fragment count
+ *   [4] fragment size (all fragments but the last carry exactly this many bytes)
+ *
+ * The receiver answers a fragment of type FRAG_DATA_ACK_REQ, and the final
+ * fragment of a transfer, with an ack carrying a bitmap of the fragments it
+ * holds:
+ *   [0] FRAG_MARKER | FRAG_ACK
+ *   [1] transfer id
+ *   [2] fragment count
+ *   [3..] bitmap, bit (i % 8) of byte (i / 8) set when fragment i was received
+ *
+ * The sender then re-sends only the missing fragments.  extras/symphony_frag.py
+ * is the matching cloud side implementation.
+ */
+
+#define FRAG_MARKER				(0xF0)
+#define FRAG_MARKER_MASK		(0xF0)
+#define FRAG_DATA				(0x01)
+#define FRAG_ACK				(0x02)
+#define FRAG_DATA_ACK_REQ		(0x03)
+
+#define FRAG_HEADER_LEN			(5)
+#define FRAG_ACK_HEADER_LEN		(3)
+#define FRAG_MAX_FRAGMENTS		(255)
+#define FRAG_BITMAP_LEN			((FRAG_MAX_FRAGMENTS + 7) / 8)
+
+//Give up on a transfer after this many unanswered rounds
+#define FRAG_MAX_ROUNDS			(5)
+
+enum FragResult
+{
+	FRAG_NONE = 0,			//not a fragmentation frame
+	FRAG_PENDING,			//accepted, transfer not complete yet
+	FRAG_COMPLETE,			//transfer complete
+	FRAG_ERROR				//malformed or doesn't fit
+};
+
+//Splits a caller owned buffer into fragments and tracks which are acked
+class FragmentSender {
+
+	public:
+
+		FragmentSender();
+
+		bool start(const uint8_t* buf, uint16_t len, uint8_t frag_size, bool reliable);
+		void cancel(void);
+		bool busy(void);
+
+		//Build the next fragment to transmit, returns its length or 0 if none is due
+		uint16_t next(uint8_t* out, uint16_t out_len, uint32_t now);
+
+		//Feed a received ack frame
+		FragResult handleAck(const uint8_t* frame, uint16_t len);
+
+		//Re-send outstanding fragments when no ack arrived in time.  Returns
+		//FRAG_ERROR once the transfer has been abandoned.
+		FragResult poll(uint32_t now, uint32_t ack_timeout_ms);
+
+		//True while a round is waiting for its ack; ackSentAt() is when it was asked for
+		bool awaitingAck(void);
+		uint32_t ackSentAt(void);
+
+	private:
+
+		const uint8_t* _buf;
+		uint16_t _len;
+		uint8_t _fragSize;
+		uint8_t _count;
+		uint8_t _id;
+		uint8_t _cursor;
+		uint8_t _rounds;
+		bool _active;
+		bool _reliable;
+		bool _awaitingAck;
+		uint32_t _sentAt;
+		uint8_t _pending[FRAG_BITMAP_LEN];
+};
+
+//Reassembles fragments into a caller owned buffer
+class FragmentReceiver {
+
+	public:
+
+		FragmentReceiver();
+
+		//Transfers of more than max_count fragments are refused, so the ack
+		//bitmap stays within what the caller can send back
+		void begin(uint8_t* buf, uint16_t size, uint8_t max_count = FRAG_MAX_FRAGMENTS);
+		bool enabled(void);
+		FragResult push(const uint8_t* frame, uint16_t len, uint32_t now);
+
+		//True after push() if an ack should be sent; buildAck() writes it
+		bool ackNeeded(void);
+		uint16_t buildAck(uint8_t* out, uint16_t out_len);
+
+		//Drop a stalled transfer
+		void poll(uint32_t now, uint32_t timeout_ms);
+
+		uint16_t length(void);
+		uint8_t* data(void);
+
+	private:
+
+		uint8_t* _buf;
+		uint16_t _size;
+		uint16_t _len;
+		uint8_t _maxCount;
+		uint8_t _id;
+		uint8_t _count;
+		uint8_t _fragSize;
+		uint8_t _received;
+		bool _active;
+		bool _complete;
+		bool _ackNeeded;
+		uint32_t _lastRx;
+		uint8_t _bitmap[FRAG_BITMAP_LEN];
+};
+
+#endif // SYMPHONYLINKFRAG_H
@@ -0,0 +1,466 @@
+#include "SymphonyLinkJournal.h"
+#include <string.h>
+
+#if defined(__AVR__)
+#include <avr/eeprom.h>
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define JOURNAL_MAGIC			(0x4A)
+
+//The consumed state only clears bits so flash can mark it without an erase
+#define JOURNAL_STATE_VALID		(0x0F)
+#define JOURNAL_STATE_CONSUMED	(0x00)
+
+
+uint16_t journalCrc(uint16_t crc, const uint8_t* buf, uint16_t len)
+{
+	uint16_t i;
+
+	for(i = 0; i < len; i++)
+	{
+		crc  = (crc >> 8) | (crc << 8);
+		crc ^= buf[i];
+		crc ^= (crc & 0xff) >> 4;
+		crc ^= crc << 12;
+		crc ^= (crc & 0xff) << 5;
+	}
+	return crc;
+}
+
+
+#if defined(__AVR__)
+EepromJournalStorage::EepromJournalStorage(uint16_t base, uint16_t len)
+{
+	_base = base;
+	_len = len;
+}
+
+uint32_t EepromJournalStorage::size(void)
+{
+	return _len;
+}
+
+bool EepromJournalStorage::read(uint32_t addr, uint8_t* buf, uint16_t len)
+{
+	eeprom_read_block(buf, (const void*)(uintptr_t)(_base + addr), len);
+	return true;
+}
+
+bool EepromJournalStorage::write(uint32_t addr, const uint8_t* buf, uint16_t len)
+{
+	//update only rewrites cells whose value changes
+	eeprom_update_block(buf, (void*)(uintptr_t)(_base + addr), len);
+	return true;
+}
+#endif
+
+
+#if defined(__linux__)
+FileJournalStorage::FileJournalStorage()
+{
+	_fd = -1;
+	_map = NULL;
+	_len = 0;
+}
+
+FileJournalStorage::~FileJournalStorage()
+{
+	close();
+}
+
+bool FileJournalStorage::open(const char* path, uint32_t len)
+{
+	struct stat st;
+	void* map;
+
+	close();
+
+	_fd = ::open(path, O_RDWR | O_CREAT, 0644);
+	if(_fd < 0)
+	{
+		return false;
+	}
+
+	//A new file is extended with zeros, which never parse as valid records
+	if((fstat(_fd, &st) < 0) ||
+	   (((uint32_t)st.st_size < len) && (ftruncate(_fd, len) < 0)))
+	{
+		close();
+		return false;
+	}
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if(map == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+
+	_map = (uint8_t*)map;
+	_len = len;
+	return true;
+}
+
+void FileJournalStorage::close(void)
+{
+	if(_map != NULL)
+	{
+		msync(_map, _len, MS_SYNC);
+		munmap(_map, _len);
+		_map = NULL;
+	}
+	if(_fd >= 0)
+	{
+		::close(_fd);
+		_fd = -1;
+	}
+	_len = 0;
+}
+
+uint32_t FileJournalStorage::size(void)
+{
+	return _len;
+}
+
+bool FileJournalStorage::read(uint32_t addr, uint8_t* buf, uint16_t len)
+{
+	if((_map == NULL) || (addr + len > _len))
+	{
+		return false;
+	}
+	memcpy(buf, _map + addr, len);
+	return true;
+}
+
+bool FileJournalStorage::write(uint32_t addr, const uint8_t* buf, uint16_t len)
+{
+	if((_map == NULL) || (addr + len > _len))
+	{
+		return false;
+	}
+	memcpy(_map + addr, buf, len);
+	return true;
+}
+
+bool FileJournalStorage::flush(void)
+{
+	return (_map != NULL) && (msync(_map, _len, MS_SYNC) == 0);
+}
+#endif
+
+
+SymphonyLinkJournal::SymphonyLinkJournal(JournalStorage* storage, uint16_t slot_size)
+{
+	_storage = storage;
+	_slotSize = slot_size;
+	_slots = 0;
+	_head = 0;
+	_tail = 0;
+	_count = 0;
+	_seq = 1;
+}
+
+bool SymphonyLinkJournal::begin(void)
+{
+	uint16_t i;
+	uint32_t seq;
+	uint16_t len;
+	uint8_t state;
+	bool found = false;
+	bool live = false;
+	uint32_t newest = 0;
+	uint16_t newestSlot = 0;
+	uint32_t oldest = 0;
+	uint16_t oldestSlot = 0;
+
+	uint32_t eraseSize = _storage->eraseSize();
+
+	if(_slotSize <= JOURNAL_HEADER_LEN)
+	{
+		return false;
+	}
+	if((eraseSize != 0) && ((eraseSize % _slotSize) != 0) && ((_slotSize % eraseSize) != 0))
+	{
+		return false;
+	}
+
+	_slots = (uint16_t)(_storage->size() / _slotSize);
+	_head = 0;
+	_tail = 0;
+	_count = 0;
+	_seq = 1;
+
+	if(_slots == 0)
+	{
+		return false;
+	}
+
+	//The newest intact record marks where writing resumes
+	for(i = 0; i < _slots; i++)
+	{
+		if(readHeader(i, &seq, &len, &state) && checkSlot(i, len))
+		{
+			if(!found || ((int32_t)(seq - newest) > 0))
+			{
+				newest = seq;
+				newestSlot = i;
+				found = true;
+			}
+		}
+	}
+
+	if(!found)
+	{
+		return true;
+	}
+
+	//The oldest unconsumed record from the current lap is the tail
+	for(i = 0; i < _slots; i++)
+	{
+		if(readHeader(i, &seq, &len, &state) && (state == JOURNAL_STATE_VALID) &&
+		   ((uint32_t)(newest - seq) < _slots) && checkSlot(i, len))
+		{
+			if(!live || ((int32_t)(seq - oldest) < 0))
+			{
+				oldest = seq;
+				oldestSlot = i;
+				live = true;
+			}
+		}
+	}
+
+	_head = (newestSlot + 1) % _slots;
+	_seq = newest + 1;
+
+	if(live)
+	{
+		_tail = oldestSlot;
+		_count = (uint16_t)(newest - oldest + 1);
+	}
+	else
+	{
+		_tail = _head;
+	}
+
+	return true;
+}
+
+bool SymphonyLinkJournal::append(const uint8_t* buf, uint16_t len)
+{
+	uint8_t hdr[JOURNAL_HEADER_LEN];
+	uint16_t crc;
+	uint32_t addr;
+
+	if((_slots == 0) || (len == 0) || (len > maxMessageLen()) ||
+	   (_count >= _slots) || !prepareSlot(_head))
+	{
+		return false;
+	}
+
+	hdr[0] = JOURNAL_MAGIC;
+	hdr[1] = JOURNAL_STATE_VALID;
+	hdr[2] = (uint8_t)(_seq >> 24);
+	hdr[3] = (uint8_t)(_seq >> 16);
+	hdr[4] = (uint8_t)(_seq >> 8);
+	hdr[5] = (uint8_t)(_seq);
+	hdr[6] = (uint8_t)(len >> 8);
+	hdr[7] = (uint8_t)(len);
+
+	crc = journalCrc(0, &hdr[2], 6);
+	crc = journalCrc(crc, buf, len);
+	hdr[8] = (uint8_t)(crc >> 8);
+	hdr[9] = (uint8_t)(crc);
+
+	//Payload first so a torn write can never leave a header describing it
+	addr = slotAddr(_head);
+	if(!_storage->write(addr + JOURNAL_HEADER_LEN, buf, len) ||
+	   !_storage->write(addr, hdr, JOURNAL_HEADER_LEN) ||
+	   !_storage->flush())
+	{
+		return false;
+	}
+
+	_head = (_head + 1) % _slots;
+	_seq++;
+	_count++;
+	return true;
+}
+
+int32_t SymphonyLinkJournal::peek(uint8_t* buf, uint16_t len)
+{
+	uint8_t hdr[JOURNAL_HEADER_LEN];
+	uint32_t seq;
+	uint16_t msgLen;
+	uint8_t state;
+	uint16_t crc;
+
+	if(_count == 0)
+	{
+		return JOURNAL_EMPTY;
+	}
+
+	//A failed read says nothing about the record, only a bad one is dropped
+	if(!_storage->read(slotAddr(_tail), hdr, JOURNAL_HEADER_LEN))
+	{
+		return JOURNAL_READ_ERROR;
+	}
+	if(!parseHeader(hdr, &seq, &msgLen, &state) || (state != JOURNAL_STATE_VALID) || (msgLen > len))
+	{
+		return JOURNAL_CORRUPT;
+	}
+	if(!_storage->read(slotAddr(_tail) + JOURNAL_HEADER_LEN, buf, msgLen))
+	{
+		return JOURNAL_READ_ERROR;
+	}
+
+	crc = journalCrc(0, &hdr[2], 6);
+	crc = journalCrc(crc, buf, msgLen);
+	if(crc != (((uint16_t)hdr[8] << 8) | hdr[9]))
+	{
+		return JOURNAL_CORRUPT;
+	}
+	return msgLen;
+}
+
+bool SymphonyLinkJournal::pop(void)
+{
+	uint8_t state = JOURNAL_STATE_CONSUMED;
+
+	if(_count == 0)
+	{
+		return false;
+	}
+
+	if(!_storage->write(slotAddr(_tail) + 1, &state, 1) || !_storage->flush())
+	{
+		return false;
+	}
+
+	_tail = (_tail + 1) % _slots;
+	_count--;
+	return true;
+}
+
+uint16_t SymphonyLinkJournal::count(void)
+{
+	return _count;
+}
+
+uint16_t SymphonyLinkJournal::capacity(void)
+{
+	return _slots;
+}
+
+uint16_t SymphonyLinkJournal::maxMessageLen(void)
+{
+	return _slotSize - JOURNAL_HEADER_LEN;
+}
+
+bool SymphonyLinkJournal::readHeader(uint16_t slot, uint32_t* seq, uint16_t* len, uint8_t* state)
+{
+	uint8_t hdr[JOURNAL_HEADER_LEN];
+
+	return _storage->read(slotAddr(slot), hdr, JOURNAL_HEADER_LEN) && parseHeader(hdr, seq, len, state);
+}
+
+bool SymphonyLinkJournal::parseHeader(const uint8_t* hdr, uint32_t* seq, uint16_t* len, uint8_t* state)
+{
+	if(hdr[0] != JOURNAL_MAGIC)
+	{
+		return false;
+	}
+
+	*state = hdr[1];
+	*seq = ((uint32_t)hdr[2] << 24) | ((uint32_t)hdr[3] << 16) | ((uint32_t)hdr[4] << 8) | hdr[5];
+	*len = ((uint16_t)hdr[6] << 8) | hdr[7];
+
+	return ((*state == JOURNAL_STATE_VALID) || (*state == JOURNAL_STATE_CONSUMED)) &&
+		   (*len != 0) && (*len <= maxMessageLen());
+}
+
+bool SymphonyLinkJournal::checkSlot(uint16_t slot, uint16_t len)
+{
+	uint8_t buf[16];
+	uint8_t hdr[JOURNAL_HEADER_LEN];
+	uint32_t addr = slotAddr(slot);
+	uint16_t crc;
+	uint16_t off;
+	uint16_t chunk;
+
+	if(!_storage->read(addr, hdr, JOURNAL_HEADER_LEN))
+	{
+		return false;
+	}
+
+	crc = journalCrc(0, &hdr[2], 6);
+	for(off = 0; off < len; off += chunk)
+	{
+		chunk = (uint16_t)(len - off);
+		if(chunk > sizeof(buf))
+		{
+			chunk = sizeof(buf);
+		}
+		if(!_storage->read(addr + JOURNAL_HEADER_LEN + off, buf, chunk))
+		{
+			return false;
+		}
+		crc = journalCrc(crc, buf, chunk);
+	}
+
+	return crc == (((uint16_t)hdr[8] << 8) | hdr[9]);
+}
+
+bool SymphonyLinkJournal::prepareSlot(uint16_t slot)
+{
+	uint32_t eraseSize = _storage->eraseSize();
+	uint32_t block;
+	uint32_t first;
+	uint32_t last;
+	uint32_t addr;
+	uint16_t i;
+
+	if(eraseSize == 0)
+	{
+		return true;
+	}
+
+	//Every block the slot covers, a slot may span several
+	for(block = slotAddr(slot) / eraseSize; block <= ((slotAddr(slot) + _slotSize - 1) / eraseSize); block++)
+	{
+		//Only the first slot written into an erase block triggers the erase
+		if((slot != 0) && (((slotAddr(slot - 1) + _slotSize - 1) / eraseSize) == block))
+		{
+			continue;
+		}
+
+		//Erasing must not destroy messages that haven't been delivered yet
+		for(i = 0; i < _count; i++)
+		{
+			addr = slotAddr((_tail + i) % _slots);
+			first = addr / eraseSize;
+			last = (addr + _slotSize - 1) / eraseSize;
+			if((first <= block) && (block <= last))
+			{
+				return false;
+			}
+		}
+
+		if(!_storage->erase(block * eraseSize))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+uint32_t SymphonyLinkJournal::slotAddr(uint16_t slot)
+{
+	return (uint32_t)slot * _slotSize;
+}
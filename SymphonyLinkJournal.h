@@ -0,0 +1,131 @@
+
+#ifndef SYMPHONYLINKJOURNAL_H
+#define SYMPHONYLINKJOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Record header stored in front of every journal slot
+#define JOURNAL_HEADER_LEN		(10)
+
+//peek() results other than a message length
+#define JOURNAL_EMPTY			(-1)
+#define JOURNAL_READ_ERROR		(-2)	//the storage failed, try again later
+#define JOURNAL_CORRUPT			(-3)	//the oldest record is unusable, pop() it
+
+//CRC-16/CCITT used for stored records, start with crc = 0
+uint16_t journalCrc(uint16_t crc, const uint8_t* buf, uint16_t len);
+
+/*
+ * Non-volatile storage used by the uplink journal.  Implementations exist for
+ * AVR EEPROM and for a memory mapped file on Linux.  SPI flash parts can be
+ * supported by implementing this interface: report the sector size from
+ * eraseSize() and the journal will erase each sector before writing into it.
+ */
+class JournalStorage {
+
+	public:
+
+		virtual ~JournalStorage() {}
+
+		virtual uint32_t size(void) = 0;
+		virtual bool read(uint32_t addr, uint8_t* buf, uint16_t len) = 0;
+		virtual bool write(uint32_t addr, const uint8_t* buf, uint16_t len) = 0;
+
+		//Make previous writes durable
+		virtual bool flush(void) { return true; }
+
+		//Erase granularity in bytes, 0 if the medium can be overwritten in place
+		virtual uint32_t eraseSize(void) { return 0; }
+		virtual bool erase(uint32_t addr) { (void)addr; return true; }
+};
+
+#if defined(__AVR__)
+class EepromJournalStorage : public JournalStorage {
+
+	public:
+
+		EepromJournalStorage(uint16_t base, uint16_t len);
+
+		uint32_t size(void);
+		bool read(uint32_t addr, uint8_t* buf, uint16_t len);
+		bool write(uint32_t addr, const uint8_t* buf, uint16_t len);
+
+	private:
+
+		uint16_t _base;
+		uint16_t _len;
+};
+#endif
+
+#if defined(__linux__)
+class FileJournalStorage : public JournalStorage {
+
+	public:
+
+		FileJournalStorage();
+		~FileJournalStorage();
+
+		//Map (and create, if needed) a journal file of the given size
+		bool open(const char* path, uint32_t len);
+		void close(void);
+
+		uint32_t size(void);
+		bool read(uint32_t addr, uint8_t* buf, uint16_t len);
+		bool write(uint32_t addr, const uint8_t* buf, uint16_t len);
+		bool flush(void);
+
+	private:
+
+		int _fd;
+		uint8_t* _map;
+		uint32_t _len;
+};
+#endif
+
+/*
+ * Persistent FIFO of uplink messages.
+ *
+ * The storage is divided into fixed-size slots used round-robin, which spreads
+ * writes evenly over the medium.  Each slot holds one message behind a header
+ * with a sequence number and a CRC; a slot written only partially before a
+ * power loss fails the CRC and is ignored.  Messages are marked consumed by
+ * clearing a single state byte once delivered, so delivery is at-least-once.
+ * begin() rebuilds head and tail by scanning the slot headers.  On storage
+ * with an erase granularity, slots and erase blocks must nest: the slot
+ * size divides the erase size or the other way round, so an erase never
+ * takes part of a slot that is still in use.
+ */
+class SymphonyLinkJournal {
+
+	public:
+
+		SymphonyLinkJournal(JournalStorage* storage, uint16_t slot_size);
+
+		bool begin(void);
+		bool append(const uint8_t* buf, uint16_t len);
+		int32_t peek(uint8_t* buf, uint16_t len);
+		bool pop(void);
+
+		uint16_t count(void);
+		uint16_t capacity(void);
+		uint16_t maxMessageLen(void);
+
+	private:
+
+		JournalStorage* _storage;
+		uint16_t _slotSize;
+		uint16_t _slots;
+		uint16_t _head;
+		uint16_t _tail;
+		uint16_t _count;
+		uint32_t _seq;			//sequence number of the next append
+
+		bool readHeader(uint16_t slot, uint32_t* seq, uint16_t* len, uint8_t* state);
+		bool parseHeader(const uint8_t* hdr, uint32_t* seq, uint16_t* len, uint8_t* state);
+		bool checkSlot(uint16_t slot, uint16_t len);
+		bool prepareSlot(uint16_t slot);
+		uint32_t slotAddr(uint16_t slot);
+};
+
+#endif // SYMPHONYLINKJOURNAL_H
@@ -0,0 +1,1258 @@
+#include "SymphonyLinkLoRaWAN.h"
+
+
+LoRaWANLink::LoRaWANLink()
+{
+	_state = LORAWAN_INIT;
+	_activateAt = 0;
+	_wasReset = false;
+	_resumable = false;
+	_IRQ = 0;
+	_irqPin = -1;
+	_irqReadAt = 0;
+	_abp = false;
+	ll_lorawan_join_init(&_join);
+	_class = LL_LORAWAN_CLASS_A;
+	_network = LL_LORAWAN_PUBLIC;
+	memset(_devEui, 0, sizeof(_devEui));
+	memset(_appEui, 0, sizeof(_appEui));
+	memset(_appKey, 0, sizeof(_appKey));
+	_netId = 0;
+	_devAddr = 0;
+	memset(_nwkSKey, 0, sizeof(_nwkSKey));
+	memset(_appSKey, 0, sizeof(_appSKey));
+
+	memset(_queue, 0, sizeof(_queue));
+	memset(_order, 0, sizeof(_order));
+	_count = 0;
+	memset(_inflight, 0, sizeof(_inflight));
+	_inflightCount = 0;
+	memset(_batch, 0, sizeof(_batch));
+	memset(_batchPorts, 0, sizeof(_batchPorts));
+	_retries = LW_CONFIRMED_RETRIES;
+	_txActive = false;
+	_txStarted = 0;
+	_txRetryPending = false;
+	_txRetryAt = 0;
+	_txCallback = NULL;
+	_outcomeCallback = NULL;
+	_lastId = 0;
+	_txConfirmed = false;
+	_txMaxRetries = 0;
+	_acked = false;
+	_ackRetries = 0;
+	_ackAt = 0;
+	memset(&_delivery, 0, sizeof(_delivery));
+	_retriesAvg = 0;
+	_latencyAvg = 0;
+
+	_uplinkCounter = 0;
+	_session = NULL;
+	ll_lorawan_param_cache_init(&_params);
+
+	memset(_handlers, 0, sizeof(_handlers));
+	_multicast = NULL;
+	_mcastPort = LW_MCAST_PORT;
+	_mcastRepairPort = LW_MCAST_REPAIR_PORT;
+	_multicastHandler = NULL;
+	memset(_rxQueue, 0, sizeof(_rxQueue));
+	_rxHead = 0;
+	_rxCount = 0;
+	_rxDropped = 0;
+
+	_linkCheckInterval = 0;
+	_uplinksSinceCheck = 0;
+	_linkCheckRequested = false;
+	memset(&_linkCheck, 0, sizeof(_linkCheck));
+	_linkCheck.interval = LW_LINK_CHECK_MIN;
+	_linkCheckAt = 0;
+	_linkCheckAdaptive = false;
+	_marginAvg = 0;
+	_gatewaysAvg = 0;
+	_linkCheckInFlight = false;
+	_linkCheckAnswered = false;
+	_confirmAdaptive = false;
+}
+
+boolean LoRaWANLink::begin(const uint8_t* devEui, const uint8_t* appEui, const uint8_t* appKey,
+						   ll_lorawan_device_class_e device_class, ll_lorawan_network_type_e network_type)
+{
+	memcpy(_devEui, devEui, sizeof(_devEui));
+	memcpy(_appEui, appEui, sizeof(_appEui));
+	memcpy(_appKey, appKey, sizeof(_appKey));
+	_class = device_class;
+	_network = network_type;
+	_abp = false;
+
+	return start();
+}
+
+boolean LoRaWANLink::beginABP(uint32_t net_id, uint32_t dev_addr, const uint8_t* nwk_skey, const uint8_t* app_skey,
+							  ll_lorawan_device_class_e device_class, ll_lorawan_network_type_e network_type)
+{
+	_netId = net_id;
+	_devAddr = dev_addr;
+	memcpy(_nwkSKey, nwk_skey, sizeof(_nwkSKey));
+	memcpy(_appSKey, app_skey, sizeof(_appSKey));
+	_class = device_class;
+	_network = network_type;
+	_abp = true;
+
+	return start();
+}
+
+void LoRaWANLink::setJoinPolicy(uint32_t backoff_base_ms, uint32_t backoff_max_ms, uint8_t max_attempts)
+{
+	_join.backoff_base_ms = backoff_base_ms;
+	_join.backoff_max_ms = backoff_max_ms;
+	_join.max_attempts = max_attempts;
+}
+
+void LoRaWANLink::attachSession(LoRaWANSession* session)
+{
+	_session = session;
+}
+
+//The module's IRQ line, set as an input by the application; -1 for none
+void LoRaWANLink::setIrqPin(int8_t pin)
+{
+	_irqPin = pin;
+	_irqReadAt = millis();
+}
+
+//Start over after LORAWAN_JOIN_FAILED, with fresh attempts and backoff
+boolean LoRaWANLink::rejoin(void)
+{
+	if(_state != LORAWAN_JOIN_FAILED)
+	{
+		return false;
+	}
+	_state = LORAWAN_INIT;
+	_activateAt = millis();
+	update();
+	return true;
+}
+
+boolean LoRaWANLink::start(void)
+{
+	uint32_t flags;
+
+	if(!moduleSetMacMode(LORAWAN))
+	{
+		return false;
+	}
+
+	//A reset latched now happened before begin(), so it would be taken for
+	//one during the session started next
+	if(0 > ll_irq_flags(IRQ_FLAGS_RESET, &flags))
+	{
+		Serial.write("Error ll_irq_flags\n");
+		return false;
+	}
+	_wasReset = ((flags & IRQ_FLAGS_RESET) != 0);
+	_resumable = true;
+
+	_state = LORAWAN_INIT;
+	_activateAt = millis();
+	update();
+	return true;
+}
+
+boolean LoRaWANLink::getIRQ(uint32_t flagsToClear)
+{
+	if(0 > ll_irq_flags(flagsToClear, &_IRQ))
+	{
+		Serial.write("Error ll_irq_flags\n");
+		return false;
+	}
+	return true;
+}
+
+//True when the flags are worth reading
+boolean LoRaWANLink::irqRaised(void)
+{
+	uint32_t now = millis();
+
+	if((_irqPin >= 0) && (digitalRead(_irqPin) != HIGH) && ((now - _irqReadAt) < LW_IRQ_SAFETY_MS))
+	{
+		return false;
+	}
+	_irqReadAt = now;
+	return true;
+}
+
+boolean LoRaWANLink::activate(void)
+{
+	//Only worth trying once, the first time after begin()
+	if(_resumable)
+	{
+		_resumable = false;
+		if(resume())
+		{
+			Serial.write("Session resumed\n");
+			activated();
+			_state = LORAWAN_READY;
+			return true;
+		}
+	}
+
+	if(_abp)
+	{
+		if(0 > ll_lorawan_activate_personalization(_network, _class, _netId, _devAddr, _nwkSKey, _appSKey))
+		{
+			Serial.write("Error ll_lorawan_activate_personalization\n");
+			return false;
+		}
+		activated();
+		_state = LORAWAN_READY;
+		return true;
+	}
+
+	if(0 > ll_lorawan_join_start(&_join, _network, _class, _devEui, _appEui, _appKey, millis()))
+	{
+		Serial.write("Error ll_lorawan_join_start\n");
+		return false;
+	}
+	_state = LORAWAN_JOINING;
+	return true;
+}
+
+void LoRaWANLink::activated(void)
+{
+	//Another session may go through other gateways; its first answer seeds
+	//the averages and extremes again
+	_linkCheck.valid = false;
+	_linkCheck.missed = 0;
+	_linkCheck.marginal = false;
+	_linkCheck.interval = LW_LINK_CHECK_MIN;
+
+	//Everything the session depends on in one batch
+	ll_lorawan_param_cache_invalidate(&_params, LL_LORAWAN_PARAMS_ALL);
+	if(!refreshParams(LL_LORAWAN_PARAM_BIT(LL_LORAWAN_PARAM_ADAPTIVE_DATA_RATE_ENABLED) |
+					  LL_LORAWAN_PARAM_BIT(LL_LORAWAN_PARAM_UPLINK_COUNTER) |
+					  LL_LORAWAN_PARAM_BIT(LL_LORAWAN_PARAM_DOWNLINK_COUNTER), 0))
+	{
+		Serial.write("Error reading LoRaWAN parameters\n");
+	}
+	if((_params.valid & LL_LORAWAN_PARAM_BIT(LL_LORAWAN_PARAM_UPLINK_COUNTER)) != 0)
+	{
+		_uplinkCounter = (uint32_t)_params.value[LL_LORAWAN_PARAM_UPLINK_COUNTER];
+	}
+
+	//A new session starts at the lowest data rate, ADR takes it from there
+	_adr.reset(((_params.valid & LL_LORAWAN_PARAM_BIT(LL_LORAWAN_PARAM_ADAPTIVE_DATA_RATE_ENABLED)) != 0) &&
+			   (_params.value[LL_LORAWAN_PARAM_ADAPTIVE_DATA_RATE_ENABLED] != 0),
+			   _uplinkCounter, millis());
+
+	//A new session is stored straight away
+	if(_session != NULL)
+	{
+		saveSession();
+	}
+}
+
+void LoRaWANLink::sessionState(LoRaWANSessionState* state)
+{
+	memset(state, 0, sizeof(*state));
+	state->abp = _abp ? 1 : 0;
+	state->network = (uint8_t)_network;
+	state->device_class = (uint8_t)_class;
+	if(_abp)
+	{
+		state->net_id = _netId;
+		state->dev_addr = _devAddr;
+	}
+	else
+	{
+		memcpy(state->dev_eui, _devEui, sizeof(state->dev_eui));
+		memcpy(state->app_eui, _appEui, sizeof(state->app_eui));
+	}
+}
+
+boolean LoRaWANLink::resume(void)
+{
+	const LoRaWANSessionState* saved;
+	LoRaWANSessionState current;
+
+	if((_session == NULL) || ((saved = _session->state()) == NULL))
+	{
+		return false;
+	}
+
+	//Only the session these credentials started
+	sessionState(&current);
+	if((current.abp != saved->abp) || (current.network != saved->network) ||
+	   (current.device_class != saved->device_class) ||
+	   (current.net_id != saved->net_id) || (current.dev_addr != saved->dev_addr) ||
+	   (memcmp(current.dev_eui, saved->dev_eui, sizeof(current.dev_eui)) != 0) ||
+	   (memcmp(current.app_eui, saved->app_eui, sizeof(current.app_eui)) != 0))
+	{
+		return false;
+	}
+
+	//A module that was reset has lost it, one whose counters went back has
+	//started another since
+	if(_wasReset ||
+	   !refreshParams(LL_LORAWAN_PARAM_BIT(LL_LORAWAN_PARAM_NETWORK_ACTIVATION_STATUS) |
+					  LL_LORAWAN_PARAM_BIT(LL_LORAWAN_PARAM_UPLINK_COUNTER) |
+					  LL_LORAWAN_PARAM_BIT(LL_LORAWAN_PARAM_DOWNLINK_COUNTER), 0) ||
+	   (_params.value[LL_LORAWAN_PARAM_NETWORK_ACTIVATION_STATUS] != LL_LORAWAN_ACTIVATION_STATUS_COMPLETED) ||
+	   ((uint32_t)_params.value[LL_LORAWAN_PARAM_UPLINK_COUNTER] < saved->uplinks) ||
+	   ((uint32_t)_params.value[LL_LORAWAN_PARAM_DOWNLINK_COUNTER] < saved->downlinks))
+	{
+		return false;
+	}
+	return true;
+}
+
+void LoRaWANLink::saveSession(void)
+{
+	LoRaWANSessionState state;
+	int32_t downlinks = 0;
+
+	sessionState(&state);
+	state.uplinks = _uplinkCounter;
+	if(getParam(LL_LORAWAN_PARAM_DOWNLINK_COUNTER, &downlinks))
+	{
+		state.downlinks = (uint32_t)downlinks;
+	}
+
+	if(!_session->save(&state, millis()))
+	{
+		Serial.write("Error saving session\n");
+	}
+}
+
+lorawanState LoRaWANLink::update(void)
+{
+	int32_t ret;
+
+	switch(_state)
+	{
+		case LORAWAN_INIT:
+			if((int32_t)(millis() - _activateAt) < 0)
+			{
+				break;
+			}
+			Serial.write("State: INIT\r");
+			if(!activate())
+			{
+				_activateAt = millis() + LW_ACTIVATE_RETRY_MS;
+			}
+			break;
+
+		case LORAWAN_JOINING:
+			ret = ll_lorawan_join_step(&_join, millis());
+			if(ret == LL_LORAWAN_JOIN_JOINED)
+			{
+				Serial.write("\nJoined\n");
+				activated();
+				_state = LORAWAN_READY;
+			}
+			else if(ret == LL_LORAWAN_JOIN_FAILED)
+			{
+				Serial.write("\nJoin failed\n");
+				_state = LORAWAN_JOIN_FAILED;
+			}
+			break;
+
+		case LORAWAN_JOIN_FAILED:
+			break;
+
+		case LORAWAN_READY:
+		case LORAWAN_SENDING:
+			if(_multicast != NULL)
+			{
+				_multicast->poll(millis(), LW_MCAST_RX_TIMEOUT_MS);
+			}
+
+			if(!irqRaised())
+			{
+				_IRQ = 0;
+			}
+			else if(!getIRQ(0xFFFFFFFF))
+			{
+				break;
+			}
+
+			//Rejoin after a reset or when the network dropped us.  The frame
+			//in flight is sent again once joined.
+			if((_IRQ & (IRQ_FLAGS_RESET | IRQ_FLAGS_DISCONNECTED)) != 0)
+			{
+				Serial.write("Device lost connection\n");
+				ll_lorawan_param_cache_invalidate(&_params, LL_LORAWAN_PARAMS_ALL);
+				_txActive = false;
+				_inflightCount = 0;
+				_state = LORAWAN_INIT;
+				_activateAt = millis();
+				break;
+			}
+
+			//Acks and link-check answers arrive as downlinks
+			if((_IRQ & IRQ_FLAGS_RX_DONE) != 0)
+			{
+				ll_lorawan_param_cache_invalidate(&_params, LL_LORAWAN_PARAM_BIT(LL_LORAWAN_PARAM_DOWNLINK_COUNTER));
+				serviceDownlink();
+			}
+
+			if(_state == LORAWAN_SENDING)
+			{
+				if((_IRQ & IRQ_FLAGS_TX_DONE) != 0)
+				{
+					txComplete(true);
+				}
+				else if((_IRQ & IRQ_FLAGS_TX_ERROR) != 0)
+				{
+					Serial.write("\nError sending frame\n");
+					txComplete(false);
+				}
+				else if((millis() - _txStarted) >= LW_TX_TIMEOUT_MS)
+				{
+					Serial.write("\nFrame timed out\n");
+					txComplete(false);
+				}
+			}
+
+			if(_state == LORAWAN_READY)
+			{
+				serviceUplink();
+			}
+			break;
+	}
+
+	return _state;
+}
+
+uint32_t LoRaWANLink::pollTimeout(void)
+{
+	int32_t remaining;
+	uint32_t wait;
+
+	switch(_state)
+	{
+		case LORAWAN_INIT:
+			remaining = (int32_t)(_activateAt - millis());
+			return (remaining > 0) ? (uint32_t)remaining : 0;
+
+		case LORAWAN_JOIN_FAILED:
+			return LW_IDLE_DEADLINE_MS;
+
+		case LORAWAN_JOINING:
+			//Nothing to watch for while backing off between attempts
+			wait = ll_lorawan_join_wait_ms(&_join, millis());
+			if(ll_lorawan_join_status(&_join) == LL_LORAWAN_JOIN_BACKOFF)
+			{
+				return wait;
+			}
+			return (wait < LW_POLL_INTERVAL_MS) ? wait : LW_POLL_INTERVAL_MS;
+
+		case LORAWAN_READY:
+			if(nextFrame(_adr.converged(_uplinkCounter, millis())) >= 0)
+			{
+				if(!_txRetryPending)
+				{
+					return 0;
+				}
+				remaining = (int32_t)(_txRetryAt - millis());
+				if(remaining <= 0)
+				{
+					return 0;
+				}
+				if((uint32_t)remaining < pollInterval())
+				{
+					return remaining;
+				}
+			}
+			return pollInterval();
+
+		default:
+			return pollInterval();
+	}
+}
+
+//While joined
+uint32_t LoRaWANLink::pollInterval(void)
+{
+	if(_class != LL_LORAWAN_CLASS_C)
+	{
+		return LW_POLL_INTERVAL_MS;
+	}
+	return (_irqPin >= 0) ? LW_IRQ_PIN_POLL_MS : LW_CLASS_C_POLL_INTERVAL_MS;
+}
+
+boolean LoRaWANLink::isJoined(void)
+{
+	return (_state == LORAWAN_READY) || (_state == LORAWAN_SENDING);
+}
+
+boolean LoRaWANLink::write(uint8_t port, const uint8_t* buf, uint8_t len, boolean confirmed, Priority priority)
+{
+	uplinkFrame* f;
+	uint8_t slot;
+
+	//fPort 0 carries MAC commands, 224 and up are reserved
+	if((port == 0) || (port >= 224) || (len == 0) || (len > LW_QUEUE_MSG_LEN) ||
+	   (priority >= NUM_PRIORITIES))
+	{
+		return false;
+	}
+	//A batched write takes its record header along and would never fit
+	if(isBatchPort(port) && ((len + LW_BATCH_RECORD_HEADER) > _adr.largestPayload()))
+	{
+		Serial.write("Error batched write too long\n");
+		return false;
+	}
+	if(_count >= LW_TX_QUEUE_DEPTH)
+	{
+		Serial.write("Error uplink queue full\n");
+		return false;
+	}
+
+	for(slot = 0; _queue[slot].len != 0; slot++)
+	{
+	}
+	f = &_queue[slot];
+	f->port = port;
+	f->flags = confirmed ? LL_LORAWAN_SEND_CONFIRMED : 0;
+	f->priority = priority;
+	f->len = len;
+	//Never 0, so an id of 0 means no write yet
+	f->id = _lastId = (_lastId == 0xFFFF) ? 1 : (_lastId + 1);
+	f->queuedAt = millis();
+	memcpy(f->data, buf, len);
+	_order[_count++] = slot;
+
+	//Hand it over straight away when nothing is ahead of it
+	if(_state == LORAWAN_READY)
+	{
+		serviceUplink();
+	}
+	return true;
+}
+
+boolean LoRaWANLink::isSending(void)
+{
+	return _txActive;
+}
+
+uint16_t LoRaWANLink::pendingUplinks(void)
+{
+	return _count;
+}
+
+void LoRaWANLink::setTxCallback(LoRaWANTxCallback cb)
+{
+	_txCallback = cb;
+}
+
+void LoRaWANLink::setOutcomeCallback(LoRaWANOutcomeCallback cb)
+{
+	_outcomeCallback = cb;
+}
+
+uint16_t LoRaWANLink::lastUplinkId(void)
+{
+	return _lastId;
+}
+
+void LoRaWANLink::setConfirmedRetries(uint8_t retries)
+{
+	_retries = retries;
+}
+
+void LoRaWANLink::setRegion(LoRaWANRegion region)
+{
+	_adr.setRegion(region);
+}
+
+boolean LoRaWANLink::setBatching(uint8_t port, boolean enable)
+{
+	uint8_t i;
+	int8_t slot = -1;
+
+	for(i = 0; i < LW_MAX_BATCH_PORTS; i++)
+	{
+		if(_batchPorts[i] == port)
+		{
+			if(!enable)
+			{
+				_batchPorts[i] = 0;
+			}
+			return true;
+		}
+		if((_batchPorts[i] == 0) && (slot < 0))
+		{
+			slot = i;
+		}
+	}
+
+	if(!enable)
+	{
+		return true;
+	}
+	if((port == 0) || (port >= 224) || (slot < 0))
+	{
+		return false;
+	}
+	_batchPorts[slot] = port;
+	return true;
+}
+
+uint8_t LoRaWANLink::getDataRate(void)
+{
+	return _adr.dataRate();
+}
+
+uint8_t LoRaWANLink::getMaxPayload(uint8_t port)
+{
+	uint8_t max = _adr.maxPayload();
+
+	if(isBatchPort(port))
+	{
+		return (max > LW_BATCH_RECORD_HEADER) ? (max - LW_BATCH_RECORD_HEADER) : 0;
+	}
+	return max;
+}
+
+boolean LoRaWANLink::isAdrConverged(void)
+{
+	return _adr.converged(_uplinkCounter, millis());
+}
+
+boolean LoRaWANLink::refreshParams(uint32_t params, uint32_t max_age_ms)
+{
+	return ll_lorawan_param_cache_refresh(&_params, params, max_age_ms, millis()) >= 0;
+}
+
+boolean LoRaWANLink::getParam(enum ll_lorawan_param_e param, int32_t* value, uint32_t max_age_ms)
+{
+	return ll_lorawan_param_cache_get(&_params, param, max_age_ms, millis(), value) >= 0;
+}
+
+boolean LoRaWANLink::isBatchPort(uint8_t port)
+{
+	uint8_t i;
+
+	for(i = 0; i < LW_MAX_BATCH_PORTS; i++)
+	{
+		if((_batchPorts[i] != 0) && (_batchPorts[i] == port))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+int8_t LoRaWANLink::nextFrame(boolean bulk)
+{
+	uint8_t p;
+	uint8_t i;
+
+	//Oldest frame of the highest class waiting
+	for(p = PRIORITY_HIGH; p < NUM_PRIORITIES; p++)
+	{
+		if((p == PRIORITY_BULK) && !bulk)
+		{
+			break;
+		}
+		for(i = 0; i < _count; i++)
+		{
+			if(_queue[_order[i]].priority == p)
+			{
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+uint8_t LoRaWANLink::buildBatch(uint8_t first, boolean bulk)
+{
+	uplinkFrame* f = &_queue[_order[first]];
+	uplinkFrame* g;
+	uint8_t limit = _adr.probePayload();
+	uint16_t len;
+	uint8_t i;
+
+	//The chosen frame goes in even when it doesn't fit; the module decides
+	_batch[0] = f->len;
+	memcpy(&_batch[LW_BATCH_RECORD_HEADER], f->data, f->len);
+	len = LW_BATCH_RECORD_HEADER + f->len;
+	_inflight[0] = _order[first];
+	_inflightCount = 1;
+
+	//Then whatever else on the port fits, oldest first
+	for(i = 0; i < _count; i++)
+	{
+		g = &_queue[_order[i]];
+		if((i == first) || (g->port != f->port) || (g->flags != f->flags) ||
+		   ((g->priority == PRIORITY_BULK) && !bulk) ||
+		   ((len + LW_BATCH_RECORD_HEADER + g->len) > limit))
+		{
+			continue;
+		}
+		_batch[len] = g->len;
+		memcpy(&_batch[len + LW_BATCH_RECORD_HEADER], g->data, g->len);
+		len += LW_BATCH_RECORD_HEADER + g->len;
+		_inflight[_inflightCount++] = _order[i];
+	}
+	return (len > 0xFF) ? 0xFF : (uint8_t)len;
+}
+
+void LoRaWANLink::serviceUplink(void)
+{
+	uplinkFrame* f;
+	const uint8_t* buf;
+	uint8_t len;
+	uint8_t flags;
+	uint8_t retries;
+	boolean check;
+	boolean bulk;
+	int8_t first;
+	int32_t ret;
+
+	if((_count == 0) || _txActive ||
+	   (_txRetryPending && ((int32_t)(millis() - _txRetryAt) < 0)))
+	{
+		return;
+	}
+
+	bulk = _adr.converged(_uplinkCounter, millis());
+	first = nextFrame(bulk);
+	if(first < 0)
+	{
+		return;
+	}
+
+	f = &_queue[_order[first]];
+	if(isBatchPort(f->port))
+	{
+		len = buildBatch(first, bulk);
+		buf = _batch;
+	}
+	else
+	{
+		//Sent from the queue slot
+		_inflight[0] = _order[first];
+		_inflightCount = 1;
+		len = f->len;
+		buf = f->data;
+	}
+
+	check = _linkCheckRequested ||
+			((linkCheckInterval() != 0) && ((_uplinksSinceCheck + 1) >= linkCheckInterval()));
+	flags = f->flags | (check ? LL_LORAWAN_SEND_LINK_CHECK : 0);
+	retries = _retries;
+
+	//Over a marginal link anything but bulk is worth an acknowledgement
+	if(_confirmAdaptive)
+	{
+		if(_linkCheck.marginal && (f->priority != PRIORITY_BULK))
+		{
+			flags |= LL_LORAWAN_SEND_CONFIRMED;
+		}
+		retries = _linkCheck.marginal ? LW_RETRIES_MARGINAL : adaptiveRetries();
+	}
+
+	_txConfirmed = ((flags & LL_LORAWAN_SEND_CONFIRMED) != 0);
+	_txMaxRetries = _txConfirmed ? retries : 0;
+	_acked = false;
+	_txStarted = millis();
+
+	if((flags & LL_LORAWAN_SEND_CONFIRMED) != 0)
+	{
+		ret = ll_lorawan_send_confirmed(flags, f->port, buf, len, retries);
+	}
+	else
+	{
+		ret = ll_lorawan_send_unconfirmed(flags, f->port, buf, len);
+	}
+
+	//The module's transmit FIFO is full; not a failure
+	if(ret == -LL_IFC_NACK_BUSY_TRY_AGAIN)
+	{
+		_inflightCount = 0;
+		_txRetryAt = millis() + LW_BUSY_RETRY_MS;
+		_txRetryPending = true;
+		return;
+	}
+
+	//Too long for the data rate the module is at.  A batch is built again
+	//for the lowered estimate on the next pass.
+	if((ret == -LL_IFC_NACK_PAYLOAD_LEN_EXCEEDED) || (ret == -LL_IFC_NACK_PAYLOAD_LEN_OOR))
+	{
+		if(_adr.rejected(len, _uplinkCounter, millis()) && (_inflightCount > 1))
+		{
+			_inflightCount = 0;
+			return;
+		}
+	}
+	if(ret < 0)
+	{
+		Serial.write("Error sending frame\n");
+		txComplete(false);
+		return;
+	}
+	_adr.accepted(len, _uplinkCounter, millis());
+
+	_txRetryPending = false;
+	_txActive = true;
+	_state = LORAWAN_SENDING;
+
+	_uplinksSinceCheck++;
+	_linkCheckInFlight = check;
+	_linkCheckAnswered = false;
+	if(check)
+	{
+		_linkCheck.requested++;
+		_uplinksSinceCheck = 0;
+		_linkCheckRequested = false;
+	}
+}
+
+void LoRaWANLink::txComplete(boolean success)
+{
+	LoRaWANTxOutcome outcome;
+	uplinkFrame* f;
+	int32_t uplinks;
+	uint8_t i;
+	uint8_t k;
+
+	//The ACK may be flagged just after TX_DONE
+	if(success && _txConfirmed && !_acked)
+	{
+		ll_lorawan_param_cache_invalidate(&_params, LL_LORAWAN_PARAM_BIT(LL_LORAWAN_PARAM_DOWNLINK_COUNTER));
+		serviceDownlink();
+	}
+
+	memset(&outcome, 0, sizeof(outcome));
+	outcome.confirmed = _txConfirmed;
+	outcome.sent = success;
+	outcome.acked = _acked;
+	outcome.retries = _acked ? _ackRetries : _txMaxRetries;
+	outcome.max_retries = _txMaxRetries;
+	outcome.latency_ms = (_acked ? _ackAt : millis()) - _txStarted;
+
+	//Only what the module took says anything about the link
+	if(_txActive && _txConfirmed)
+	{
+		deliveryOutcome(_acked, outcome.retries, outcome.latency_ms);
+	}
+
+	//Every frame of a batch is reported on its own
+	for(k = 0; k < _inflightCount; k++)
+	{
+		f = &_queue[_inflight[k]];
+		if(_txCallback != NULL)
+		{
+			_txCallback(f->port, f->data, f->len, success);
+		}
+		if(_outcomeCallback != NULL)
+		{
+			outcome.id = f->id;
+			outcome.port = f->port;
+			outcome.len = f->len;
+			outcome.queued_ms = _txStarted - f->queuedAt;
+			_outcomeCallback(&outcome);
+		}
+		f->len = 0;
+
+		for(i = 0; _order[i] != _inflight[k]; i++)
+		{
+		}
+		_count--;
+		memmove(&_order[i], &_order[i + 1], _count - i);
+	}
+	_inflightCount = 0;
+
+	//ADR convergence is counted in uplinks the module made, retransmissions
+	//and MAC-only frames included
+	ll_lorawan_param_cache_invalidate(&_params, LL_LORAWAN_PARAM_BIT(LL_LORAWAN_PARAM_UPLINK_COUNTER));
+	if(getParam(LL_LORAWAN_PARAM_UPLINK_COUNTER, &uplinks))
+	{
+		_uplinkCounter = (uint32_t)uplinks;
+	}
+	else if(success)
+	{
+		_uplinkCounter++;
+	}
+	if((_session != NULL) && _session->due(_uplinkCounter, millis()))
+	{
+		saveSession();
+	}
+
+	//The answer comes in the receive windows after the request went out
+	if(success && _linkCheckInFlight && !_linkCheckAnswered)
+	{
+		if(_linkCheck.missed < 0xFF)
+		{
+			_linkCheck.missed++;
+		}
+		updateLinkHealth(false);
+	}
+	_linkCheckInFlight = false;
+	_txConfirmed = false;
+
+	_txActive = false;
+	_txRetryPending = false;
+	_state = LORAWAN_READY;
+}
+
+void LoRaWANLink::serviceDownlink(void)
+{
+	ll_lorawan_rx_t rx;
+	int32_t ret;
+	uint8_t slot;
+	uint8_t i;
+
+	//The module may hold more than one; stop at the first empty receive
+	for(i = 0; i < LW_RX_QUEUE_DEPTH; i++)
+	{
+		//Received in place into the slot after the newest, which is free
+		//even when the queue is full.  An empty receive writes nothing.
+		slot = (uint8_t)((_rxHead + _rxCount) % LW_RX_SLOTS);
+
+		memset(&rx, 0, sizeof(rx));
+		ret = ll_lorawan_receive(_rxQueue[slot].data, sizeof(_rxQueue[slot].data), &rx);
+		if((ret < 0) && (ret != LL_IFC_ERROR_BUFFER_TOO_SMALL))
+		{
+			Serial.write("Error ll_lorawan_receive\n");
+			return;
+		}
+		if(rx.flags == 0)
+		{
+			return;
+		}
+
+		//A message too long for a slot is lost, what else it carried isn't
+		if(ret < 0)
+		{
+			Serial.write("Error downlink too long\n");
+			rx.flags &= ~LL_LORAWAN_RECEIVE_MESSAGE;
+			_rxDropped++;
+		}
+
+		if((rx.flags & LL_LORAWAN_RECEIVE_LINK_CHECK) != 0)
+		{
+			linkCheckAnswer(&rx);
+		}
+
+		//Only the frame in flight can be acknowledged
+		if(((rx.flags & LL_LORAWAN_RECEIVE_ACK) != 0) && _txActive && _txConfirmed && !_acked)
+		{
+			_acked = true;
+			_ackRetries = rx.TxNbRetries;
+			_ackAt = millis();
+		}
+
+		if(((rx.flags & LL_LORAWAN_RECEIVE_MESSAGE) != 0) && (rx.bytes_received != 0))
+		{
+			if(!dispatchGroup(_rxQueue[slot].data, &rx) && !dispatch(_rxQueue[slot].data, &rx))
+			{
+				//Only now does the oldest have to make room
+				if(_rxCount == LW_RX_QUEUE_DEPTH)
+				{
+					_rxHead = (_rxHead + 1) % LW_RX_SLOTS;
+					_rxCount--;
+					_rxDropped++;
+				}
+				_rxQueue[slot].rx = rx;
+				_rxCount++;
+			}
+		}
+	}
+}
+
+//False when it isn't a frame for a group joined
+boolean LoRaWANLink::dispatchGroup(const uint8_t* buf, const ll_lorawan_rx_t* rx)
+{
+	const uint8_t* payload;
+	uint16_t len;
+	uint8_t group;
+	McastResult result;
+
+	if((_multicast == NULL) || ((rx->RxPort != _mcastPort) && (rx->RxPort != _mcastRepairPort)))
+	{
+		return false;
+	}
+
+	result = _multicast->push(buf, rx->bytes_received, millis(), &group, &payload, &len);
+	if((result == MCAST_NONE) || (result == MCAST_IGNORED))
+	{
+		return false;
+	}
+
+	if(result == MCAST_ERROR)
+	{
+		Serial.write("Error multicast frame\n");
+	}
+	else if((result == MCAST_DELIVER) && (_multicastHandler != NULL))
+	{
+		_multicastHandler(group, payload, len, rx);
+	}
+	return true;
+}
+
+//False when nobody claimed the downlink
+boolean LoRaWANLink::dispatch(const uint8_t* buf, const ll_lorawan_rx_t* rx)
+{
+	LoRaWANRxHandler fallback = NULL;
+	uint8_t i;
+
+	for(i = 0; i < LW_MAX_PORT_HANDLERS; i++)
+	{
+		if(_handlers[i].handler == NULL)
+		{
+			continue;
+		}
+		if(_handlers[i].port == rx->RxPort)
+		{
+			_handlers[i].handler(rx->RxPort, buf, rx->bytes_received, rx);
+			return true;
+		}
+		if(_handlers[i].port == 0)
+		{
+			fallback = _handlers[i].handler;
+		}
+	}
+
+	if(fallback != NULL)
+	{
+		fallback(rx->RxPort, buf, rx->bytes_received, rx);
+		return true;
+	}
+	return false;
+}
+
+boolean LoRaWANLink::onReceive(uint8_t port, LoRaWANRxHandler handler)
+{
+	uint8_t i;
+	int8_t slot = -1;
+
+	//Port 0 registers a handler for every port without its own
+	for(i = 0; i < LW_MAX_PORT_HANDLERS; i++)
+	{
+		if((_handlers[i].handler != NULL) && (_handlers[i].port == port))
+		{
+			_handlers[i].handler = handler;
+			return true;
+		}
+		if((_handlers[i].handler == NULL) && (slot < 0))
+		{
+			slot = i;
+		}
+	}
+
+	if((handler == NULL) || (slot < 0))
+	{
+		return handler == NULL;
+	}
+	_handlers[slot].port = port;
+	_handlers[slot].handler = handler;
+	return true;
+}
+
+void LoRaWANLink::attachMulticast(MulticastGroups* groups, uint8_t port, uint8_t repair_port)
+{
+	_multicast = groups;
+	_mcastPort = port;
+	_mcastRepairPort = repair_port;
+}
+
+void LoRaWANLink::onMulticast(LoRaWANMulticastHandler handler)
+{
+	_multicastHandler = handler;
+}
+
+//Oldest first
+boolean LoRaWANLink::read(uint8_t* port, uint8_t* buf, uint8_t* len, ll_lorawan_rx_t* rx)
+{
+	downlinkFrame* frame = &_rxQueue[_rxHead];
+
+	if(_rxCount == 0)
+	{
+		*len = 0;
+		return false;
+	}
+	
+	if(*len < frame->rx.bytes_received)
+	{
+		*len = frame->rx.bytes_received;
+		return false;
+	}
+
+	memcpy(buf, frame->data, frame->rx.bytes_received);
+	*len = frame->rx.bytes_received;
+	*port = frame->rx.RxPort;
+	if(rx != NULL)
+	{
+		*rx = frame->rx;
+	}
+	_rxHead = (_rxHead + 1) % LW_RX_SLOTS;
+	_rxCount--;
+	return true;
+}
+
+uint8_t LoRaWANLink::pendingDownlinks(void)
+{
+	return _rxCount;
+}
+
+uint16_t LoRaWANLink::droppedDownlinks(void)
+{
+	return _rxDropped;
+}
+
+void LoRaWANLink::setLinkCheckInterval(uint16_t uplinks)
+{
+	_linkCheckInterval = uplinks;
+	_linkCheckAdaptive = false;
+}
+
+void LoRaWANLink::setAdaptiveLinkCheck(boolean enable)
+{
+	_linkCheckAdaptive = enable;
+}
+
+uint16_t LoRaWANLink::linkCheckInterval(void)
+{
+	return _linkCheckAdaptive ? _linkCheck.interval : _linkCheckInterval;
+}
+
+void LoRaWANLink::linkCheckAnswer(const ll_lorawan_rx_t* rx)
+{
+	_linkCheck.margin = rx->DemodMargin;
+	_linkCheck.gateways = rx->NbGateways;
+	_linkCheck.rssi = rx->RxRssi;
+	_linkCheck.snr = (int8_t)rx->RxSnr;
+	_linkCheck.missed = 0;
+	_linkCheckAnswered = true;
+	_linkCheckAt = millis();
+
+	if(!_linkCheck.valid)
+	{
+		_marginAvg = rx->DemodMargin * (1 << LW_LINK_EWMA_SHIFT);
+		_gatewaysAvg = rx->NbGateways * (1 << LW_LINK_EWMA_SHIFT);
+		_linkCheck.margin_min = rx->DemodMargin;
+		_linkCheck.gateways_min = _linkCheck.gateways_max = rx->NbGateways;
+		_linkCheck.valid = true;
+	}
+	else
+	{
+		_marginAvg += rx->DemodMargin - (_marginAvg >> LW_LINK_EWMA_SHIFT);
+		_gatewaysAvg += rx->NbGateways - (_gatewaysAvg >> LW_LINK_EWMA_SHIFT);
+		_linkCheck.margin_min = min(_linkCheck.margin_min, rx->DemodMargin);
+		_linkCheck.gateways_min = min(_linkCheck.gateways_min, rx->NbGateways);
+		_linkCheck.gateways_max = max(_linkCheck.gateways_max, rx->NbGateways);
+	}
+	_linkCheck.margin_avg = _marginAvg >> LW_LINK_EWMA_SHIFT;
+	_linkCheck.gateways_avg = _gatewaysAvg >> LW_LINK_EWMA_SHIFT;
+
+	if(_linkCheck.answered < 0xFFFF)
+	{
+		_linkCheck.answered++;
+	}
+	updateLinkHealth(true);
+}
+
+void LoRaWANLink::deliveryOutcome(boolean acked, uint8_t retries, uint32_t latency)
+{
+	if(_delivery.confirmed < 0xFFFF)
+	{
+		_delivery.confirmed++;
+	}
+
+	if(!acked)
+	{
+		if(_delivery.missed < 0xFF)
+		{
+			_delivery.missed++;
+		}
+		updateLinkHealth(false);
+		return;
+	}
+
+	if(_delivery.acked == 0)
+	{
+		_retriesAvg = retries * (1 << LW_LINK_EWMA_SHIFT);
+		_latencyAvg = latency * (1 << LW_LINK_EWMA_SHIFT);
+		_delivery.retries_max = retries;
+	}
+	else
+	{
+		_retriesAvg += retries - (_retriesAvg >> LW_LINK_EWMA_SHIFT);
+		_latencyAvg += latency - (_latencyAvg >> LW_LINK_EWMA_SHIFT);
+		_delivery.retries_max = max(_delivery.retries_max, retries);
+	}
+	if(_delivery.acked < 0xFFFF)
+	{
+		_delivery.acked++;
+	}
+	_delivery.missed = 0;
+	updateLinkHealth(false);
+}
+
+//What the ACKs so far needed, with some to spare
+uint8_t LoRaWANLink::adaptiveRetries(void)
+{
+	uint8_t retries;
+
+	if(_delivery.acked == 0)
+	{
+		return LW_RETRIES_HEALTHY;
+	}
+	retries = ((_retriesAvg + (1 << LW_LINK_EWMA_SHIFT) - 1) >> LW_LINK_EWMA_SHIFT) + LW_RETRIES_HEADROOM;
+	return min(max(retries, (uint8_t)LW_RETRIES_HEALTHY), (uint8_t)LW_RETRIES_MARGINAL);
+}
+
+void LoRaWANLink::updateLinkHealth(boolean answered)
+{
+	//Averages compared at full scale so a fraction of a gateway counts.  A
+	//latest margin below the threshold is a fade the average hasn't seen yet.
+	_linkCheck.marginal = (_linkCheck.missed >= LW_LINK_MISSED_LIMIT) ||
+						  (_delivery.missed >= LW_ACK_MISSED_LIMIT) ||
+						  (_linkCheck.valid &&
+						   ((_linkCheck.margin < LW_LINK_MARGIN_THRESHOLD) ||
+							(_marginAvg < (LW_LINK_MARGIN_THRESHOLD << LW_LINK_EWMA_SHIFT)) ||
+							(_gatewaysAvg < (LW_LINK_GATEWAY_THRESHOLD << LW_LINK_EWMA_SHIFT))));
+
+	//Look often while there is reason to, rarely once there isn't
+	if(_linkCheck.marginal)
+	{
+		_linkCheck.interval = LW_LINK_CHECK_MIN;
+	}
+	else if(answered && (_linkCheck.interval < LW_LINK_CHECK_MAX))
+	{
+		_linkCheck.interval = min((uint16_t)(_linkCheck.interval * 2), (uint16_t)LW_LINK_CHECK_MAX);
+	}
+}
+
+boolean LoRaWANLink::getDelivery(LoRaWANDelivery* delivery)
+{
+	*delivery = _delivery;
+	delivery->retries_avg = (_retriesAvg + (1 << LW_LINK_EWMA_SHIFT) - 1) >> LW_LINK_EWMA_SHIFT;
+	delivery->latency_avg_ms = _latencyAvg >> LW_LINK_EWMA_SHIFT;
+	return _delivery.acked != 0;
+}
+
+boolean LoRaWANLink::isLinkMarginal(void)
+{
+	return _linkCheck.marginal;
+}
+
+void LoRaWANLink::setAdaptiveConfirm(boolean enable)
+{
+	_confirmAdaptive = enable;
+}
+
+void LoRaWANLink::requestLinkCheck(void)
+{
+	_linkCheckRequested = true;
+}
+
+boolean LoRaWANLink::getLinkCheck(LoRaWANLinkCheck* check)
+{
+	*check = _linkCheck;
+	check->age_ms = millis() - _linkCheckAt;
+	return _linkCheck.valid;
+}
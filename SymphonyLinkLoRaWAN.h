@@ -0,0 +1,410 @@
+
+#ifndef SYMPHONYLINKLORAWAN_H
+#define SYMPHONYLINKLORAWAN_H
+
+
+#include "arduino.h"
+#include "ll_ifc_consts.h"
+#include "ll_ifc.h"
+#include "ll_ifc_lorawan.h"
+#include "SymphonyLinkModule.h"
+#include "SymphonyLinkPriority.h"
+#include "SymphonyLinkAdr.h"
+#include "SymphonyLinkSession.h"
+#include "SymphonyLinkMulticast.h"
+
+//Link-check statistics, kept per session.  Answers are averaged with an
+//EWMA weight of 1/(2^LW_LINK_EWMA_SHIFT).  The link is marginal while the
+//latest or the average margin is below LW_LINK_MARGIN_THRESHOLD dB, the
+//average number of gateways below LW_LINK_GATEWAY_THRESHOLD, or
+//LW_LINK_MISSED_LIMIT requests in a row went unanswered.
+#define LW_LINK_EWMA_SHIFT			(2)
+#define LW_LINK_MARGIN_THRESHOLD	(5)
+#define LW_LINK_GATEWAY_THRESHOLD	(2)
+#define LW_LINK_MISSED_LIMIT		(2)
+
+//Adaptive link checks ride on every LW_LINK_CHECK_MIN-th uplink while the
+//link is marginal or unknown; each healthy answer doubles the spacing up to
+//LW_LINK_CHECK_MAX uplinks.
+#define LW_LINK_CHECK_MIN			(4)
+#define LW_LINK_CHECK_MAX			(64)
+
+//Retransmissions of confirmed uplinks under setAdaptiveConfirm()
+#define LW_RETRIES_HEALTHY			(1)
+#define LW_RETRIES_MARGINAL			(6)
+
+//Confirmed uplink outcomes.  The retransmissions the module needed before
+//the ACK are averaged with the link-check EWMA weight; under
+//setAdaptiveConfirm() a healthy link allows that average plus
+//LW_RETRIES_HEADROOM, at least LW_RETRIES_HEALTHY, and LW_ACK_MISSED_LIMIT
+//confirmed uplinks in a row without an ACK make the link marginal.
+#define LW_RETRIES_HEADROOM			(1)
+#define LW_ACK_MISSED_LIMIT			(2)
+
+//Uplink queue.  LW_QUEUE_MSG_LEN is the largest LoRaWAN application payload.
+#ifndef LW_TX_QUEUE_DEPTH
+#if defined(__AVR__)
+#define LW_TX_QUEUE_DEPTH			(2)
+#define LW_QUEUE_MSG_LEN			(51)
+#else
+#define LW_TX_QUEUE_DEPTH			(8)
+#define LW_QUEUE_MSG_LEN			(242)
+#endif
+#endif
+
+//Downlinks are received into a queue; those nobody registered a port
+//handler for stay there for read().  One slot beyond LW_RX_QUEUE_DEPTH is
+//kept free to receive into, so a full queue only drops its oldest when the
+//new downlink has to be queued as well.
+#if defined(__AVR__)
+#define LW_RX_QUEUE_DEPTH			(2)
+#else
+#define LW_RX_QUEUE_DEPTH			(4)
+#endif
+#define LW_RX_SLOTS					(LW_RX_QUEUE_DEPTH + 1)
+#define LW_RX_MSG_LEN				(LW_QUEUE_MSG_LEN)
+#define LW_MAX_PORT_HANDLERS		(4)
+
+//Multicast groups (attachMulticast()).  Group frames are only looked for
+//on their own fPorts: LW_MCAST_PORT for what the group is sent, and
+//LW_MCAST_REPAIR_PORT for repairs sent to one device (and its status
+//uplinks).  Frames there for groups not joined go on to the port handlers
+//like any other downlink.  A transfer that hears nothing for
+//LW_MCAST_RX_TIMEOUT_MS is dropped.
+#define LW_MCAST_PORT				(200)
+#define LW_MCAST_REPAIR_PORT		(201)
+#define LW_MCAST_RX_TIMEOUT_MS		(600000)
+
+//Confirmed uplinks are retransmitted by the module this many times
+#define LW_CONFIRMED_RETRIES		(3)
+
+//Ports whose uplinks are batched with setBatching().  A batched frame is a
+//sequence of records, each a length byte followed by that many bytes, so a
+//write to such a port can't be longer than the region's largest payload
+//less the record header.
+#define LW_MAX_BATCH_PORTS			(4)
+#define LW_BATCH_RECORD_HEADER		(1)
+
+//An uplink that hasn't reported TX_DONE or TX_ERROR after this long failed.
+//A full transmit FIFO is retried after LW_BUSY_RETRY_MS.
+#define LW_TX_TIMEOUT_MS			(120000)
+#define LW_BUSY_RETRY_MS			(1000)
+
+//A join or activation the module refused is tried again after
+//LW_ACTIVATE_RETRY_MS.  Once a join has used up its attempts the link stays
+//in LORAWAN_JOIN_FAILED until rejoin(), waking every LW_IDLE_DEADLINE_MS.
+#define LW_ACTIVATE_RETRY_MS		(10000)
+#define LW_IDLE_DEADLINE_MS			(60000)
+
+//While joined the module is polled this often without an IRQ line
+#define LW_POLL_INTERVAL_MS			(100)
+
+//Class C downlinks can arrive at any time, so a Class C device reads the
+//flags every LW_CLASS_C_POLL_INTERVAL_MS.  With an IRQ line (setIrqPin())
+//the line is sampled every LW_IRQ_PIN_POLL_MS instead and the flags are only
+//read while it is raised, or after LW_IRQ_SAFETY_MS in case it was missed.
+#define LW_CLASS_C_POLL_INTERVAL_MS	(50)
+#define LW_IRQ_PIN_POLL_MS			(10)
+#define LW_IRQ_SAFETY_MS			(1000)
+
+//Cached module parameters are read again once older than this.  The frame
+//counters are read again after traffic regardless.
+#define LW_PARAM_MAX_AGE_MS			(60000)
+
+enum lorawanState
+{
+	LORAWAN_INIT = 0,
+	LORAWAN_JOINING,
+	LORAWAN_READY,
+	LORAWAN_SENDING,
+	LORAWAN_JOIN_FAILED
+};
+
+typedef struct
+{
+	uint8_t margin;				//demodulation margin of the last answer [dB]
+	uint8_t gateways;			//gateways that heard the request
+	int16_t rssi;				//of the downlink carrying the answer
+	int8_t snr;
+	uint32_t age_ms;			//since the last answer
+	uint16_t requested;
+	uint16_t answered;
+	uint8_t margin_avg;			//EWMA [dB]
+	uint8_t margin_min;			//since activation
+	uint8_t gateways_avg;		//EWMA
+	uint8_t gateways_min;		//since activation
+	uint8_t gateways_max;
+	uint8_t missed;				//requests in a row without an answer
+	uint16_t interval;			//uplinks between requests
+	boolean marginal;
+	boolean valid;
+} LoRaWANLinkCheck;
+
+//What became of one write()
+typedef struct
+{
+	uint16_t id;				//lastUplinkId() after the write()
+	uint8_t port;
+	uint8_t len;
+	boolean confirmed;			//as sent, setAdaptiveConfirm() may have asked for an ACK
+	boolean sent;				//TX_DONE
+	boolean acked;
+	uint8_t retries;			//retransmissions before the ACK, all allowed without one
+	uint8_t max_retries;
+	uint32_t queued_ms;			//write() to hand-over to the module
+	uint32_t latency_ms;		//hand-over to the ACK, or to completion
+} LoRaWANTxOutcome;
+
+//Confirmed uplink statistics
+typedef struct
+{
+	uint16_t confirmed;			//handed to the module
+	uint16_t acked;
+	uint8_t missed;				//in a row without an ACK
+	uint8_t retries_avg;		//EWMA, rounded up
+	uint8_t retries_max;
+	uint32_t latency_avg_ms;	//EWMA, hand-over to ACK
+} LoRaWANDelivery;
+
+//Called for downlinks on a registered fPort
+typedef void (*LoRaWANRxHandler)(uint8_t port, const uint8_t* buf, uint8_t len, const ll_lorawan_rx_t* rx);
+
+//Called for messages and completed transfers to a joined multicast group
+typedef void (*LoRaWANMulticastHandler)(uint8_t group, const uint8_t* buf, uint16_t len, const ll_lorawan_rx_t* rx);
+
+//Called when an uplink has been sent, or has failed
+typedef void (*LoRaWANTxCallback)(uint8_t port, const uint8_t* buf, uint8_t len, boolean success);
+
+//Called with the outcome of every write(), after the LoRaWANTxCallback
+typedef void (*LoRaWANOutcomeCallback)(const LoRaWANTxOutcome* outcome);
+
+/*
+ * LoRaWAN counterpart of SymphonyLink.
+ *
+ * begin() puts the module in LoRaWAN mode and starts an over-the-air join
+ * (or activates by personalization); update() then advances the join, the
+ * uplink queue and downlink delivery without blocking, and is called from
+ * loop() the same way as SymphonyLink::updateModemState().
+ *
+ * One uplink is handed to the module at a time.  It completes on TX_DONE,
+ * or fails on TX_ERROR or after LW_TX_TIMEOUT_MS; confirmed uplinks are
+ * retried by the module itself.  Queued uplinks go out HIGH first, then
+ * NORMAL, then BULK; BULK is held while ADR is converging (see AdrTracker).
+ * On a port set up with setBatching() the queued uplinks with the same
+ * confirmation are packed into one frame as far as the estimated data rate
+ * allows, so every transmission carries as much as it can.  Downlinks are
+ * fetched only on RX_DONE and handed to the handler registered for their
+ * fPort, otherwise queued for read().  With setIrqPin() the flags themselves
+ * are only read when the module raises its IRQ line, so a Class C device can
+ * be polled often enough for prompt downlinks without loading the UART.
+ * Both directions go between the module and the queue slots without an
+ * intermediate copy.
+ * Link-check requests ride on uplinks, every n-th one with
+ * setLinkCheckInterval(), at a rate following the link's health with
+ * setAdaptiveLinkCheck(), or the next one after requestLinkCheck().  Their
+ * answers decide whether the link is marginal; with setAdaptiveConfirm()
+ * uplinks other than BULK are then sent confirmed, and confirmed uplinks are
+ * retried LW_RETRIES_MARGINAL times, or as often as recent ACKs needed.
+ * Every write() gets an id (lastUplinkId()) that comes back in its
+ * LoRaWANTxOutcome, which tells a confirmed uplink's ACK from its TX_DONE
+ * and carries the retransmissions and time the ACK took; confirmed uplinks
+ * going unacknowledged count against the link like missed link checks.
+ *
+ * With MulticastGroups attached, group frames (SymphonyLinkMulticast.h) on
+ * the group and repair fPorts go to the onMulticast() handler for the groups
+ * joined, whole transfers after reassembly; the group layer drops repeats,
+ * and everything else is delivered as usual.
+ *
+ * With a LoRaWANSession attached, a restart of the host alone picks up the
+ * session the module still holds instead of joining again.  It is only
+ * resumed by begin(), for the same credentials, when the module hasn't been
+ * reset and neither frame counter has gone back behind the stored snapshot;
+ * a rejoin after the link was lost always joins afresh.
+ */
+class LoRaWANLink {
+
+	public:
+
+		LoRaWANLink();
+
+		boolean begin(const uint8_t* devEui, const uint8_t* appEui, const uint8_t* appKey,
+					  ll_lorawan_device_class_e device_class = LL_LORAWAN_CLASS_A,
+					  ll_lorawan_network_type_e network_type = LL_LORAWAN_PUBLIC);
+		boolean beginABP(uint32_t net_id, uint32_t dev_addr, const uint8_t* nwk_skey, const uint8_t* app_skey,
+						 ll_lorawan_device_class_e device_class = LL_LORAWAN_CLASS_A,
+						 ll_lorawan_network_type_e network_type = LL_LORAWAN_PUBLIC);
+		void setJoinPolicy(uint32_t backoff_base_ms, uint32_t backoff_max_ms, uint8_t max_attempts);
+		void attachSession(LoRaWANSession* session);
+		void setIrqPin(int8_t pin);
+		boolean rejoin(void);
+
+		lorawanState update(void);
+		uint32_t pollTimeout(void);
+		boolean isJoined(void);
+
+		boolean write(uint8_t port, const uint8_t* buf, uint8_t len, boolean confirmed = false,
+					  Priority priority = PRIORITY_NORMAL);
+		boolean isSending(void);
+		uint16_t pendingUplinks(void);
+		void setTxCallback(LoRaWANTxCallback cb);
+		void setOutcomeCallback(LoRaWANOutcomeCallback cb);
+		uint16_t lastUplinkId(void);
+		boolean getDelivery(LoRaWANDelivery* delivery);
+		void setConfirmedRetries(uint8_t retries);
+
+		//Data rate tracking and batching
+		void setRegion(LoRaWANRegion region);
+		boolean setBatching(uint8_t port, boolean enable);
+		uint8_t getDataRate(void);
+		//For a batch port, the longest write that fits with its record header
+		uint8_t getMaxPayload(uint8_t port = 0);
+		boolean isAdrConverged(void);
+
+		//Module parameters, read in one batch when older than max_age_ms
+		boolean refreshParams(uint32_t params, uint32_t max_age_ms = LW_PARAM_MAX_AGE_MS);
+		boolean getParam(enum ll_lorawan_param_e param, int32_t* value,
+						 uint32_t max_age_ms = LW_PARAM_MAX_AGE_MS);
+
+		boolean onReceive(uint8_t port, LoRaWANRxHandler handler);
+		void attachMulticast(MulticastGroups* groups, uint8_t port = LW_MCAST_PORT,
+							 uint8_t repair_port = LW_MCAST_REPAIR_PORT);
+		void onMulticast(LoRaWANMulticastHandler handler);
+		//Oldest queued downlink.  When it doesn't fit in *len bytes it stays
+		//queued and *len is set to its length, so call again with a buffer
+		//that size; *len is 0 when nothing is queued.
+		boolean read(uint8_t* port, uint8_t* buf, uint8_t* len, ll_lorawan_rx_t* rx = NULL);
+		uint8_t pendingDownlinks(void);
+		uint16_t droppedDownlinks(void);
+
+		void setLinkCheckInterval(uint16_t uplinks);
+		void setAdaptiveLinkCheck(boolean enable);
+		void requestLinkCheck(void);
+		boolean getLinkCheck(LoRaWANLinkCheck* check);
+		boolean isLinkMarginal(void);
+		void setAdaptiveConfirm(boolean enable);
+
+	private:
+
+		typedef struct
+		{
+			uint8_t port;
+			uint8_t flags;
+			uint8_t priority;
+			uint8_t len;				//0 for a free slot
+			uint16_t id;
+			uint32_t queuedAt;
+			uint8_t data[LW_QUEUE_MSG_LEN];
+		} uplinkFrame;
+
+		typedef struct
+		{
+			ll_lorawan_rx_t rx;
+			uint8_t data[LW_RX_MSG_LEN];
+		} downlinkFrame;
+
+		typedef struct
+		{
+			uint8_t port;
+			LoRaWANRxHandler handler;
+		} portHandler;
+
+		lorawanState _state;
+		uint32_t _activateAt;
+		boolean _wasReset;			//the module lost its session before begin()
+		boolean _resumable;			//first activation since begin()
+		uint32_t _IRQ;
+		int8_t _irqPin;
+		uint32_t _irqReadAt;
+		boolean _abp;
+		ll_lorawan_join_t _join;
+		ll_lorawan_device_class_e _class;
+		ll_lorawan_network_type_e _network;
+		uint8_t _devEui[8];
+		uint8_t _appEui[8];
+		uint8_t _appKey[16];
+		uint32_t _netId;
+		uint32_t _devAddr;
+		uint8_t _nwkSKey[16];
+		uint8_t _appSKey[16];
+
+		uplinkFrame _queue[LW_TX_QUEUE_DEPTH];
+		uint8_t _order[LW_TX_QUEUE_DEPTH];		//slots, oldest first
+		uint8_t _count;
+		uint8_t _inflight[LW_TX_QUEUE_DEPTH];	//slots in the frame handed to the module
+		uint8_t _inflightCount;
+		uint8_t _batch[LW_QUEUE_MSG_LEN + LW_BATCH_RECORD_HEADER];
+		uint8_t _batchPorts[LW_MAX_BATCH_PORTS];
+		uint8_t _retries;
+		boolean _txActive;
+		uint32_t _txStarted;
+		boolean _txRetryPending;
+		uint32_t _txRetryAt;
+		LoRaWANTxCallback _txCallback;
+		LoRaWANOutcomeCallback _outcomeCallback;
+		uint16_t _lastId;
+
+		//Of the frame in flight
+		boolean _txConfirmed;
+		uint8_t _txMaxRetries;
+		boolean _acked;
+		uint8_t _ackRetries;
+		uint32_t _ackAt;
+
+		LoRaWANDelivery _delivery;
+		uint16_t _retriesAvg;		//scaled by 2^LW_LINK_EWMA_SHIFT
+		uint32_t _latencyAvg;		//scaled by 2^LW_LINK_EWMA_SHIFT
+
+		AdrTracker _adr;
+		uint32_t _uplinkCounter;
+		LoRaWANSession* _session;
+		ll_lorawan_param_cache_t _params;
+
+		portHandler _handlers[LW_MAX_PORT_HANDLERS];
+		MulticastGroups* _multicast;
+		uint8_t _mcastPort;
+		uint8_t _mcastRepairPort;
+		LoRaWANMulticastHandler _multicastHandler;
+		downlinkFrame _rxQueue[LW_RX_SLOTS];
+		uint8_t _rxHead;
+		uint8_t _rxCount;
+		uint16_t _rxDropped;
+
+		uint16_t _linkCheckInterval;
+		uint16_t _uplinksSinceCheck;
+		boolean _linkCheckRequested;
+		LoRaWANLinkCheck _linkCheck;
+		uint32_t _linkCheckAt;
+		boolean _linkCheckAdaptive;
+		uint16_t _marginAvg;		//scaled by 2^LW_LINK_EWMA_SHIFT
+		uint16_t _gatewaysAvg;		//scaled by 2^LW_LINK_EWMA_SHIFT
+		boolean _linkCheckInFlight;	//carried by the frame in flight
+		boolean _linkCheckAnswered;
+		boolean _confirmAdaptive;
+
+		boolean start(void);
+		boolean activate(void);
+		boolean getIRQ(uint32_t flagsToClear);
+		boolean irqRaised(void);
+		uint32_t pollInterval(void);
+
+		void activated(void);
+		void sessionState(LoRaWANSessionState* state);
+		boolean resume(void);
+		void saveSession(void);
+		boolean isBatchPort(uint8_t port);
+		int8_t nextFrame(boolean bulk);
+		uint8_t buildBatch(uint8_t first, boolean bulk);
+		void serviceUplink(void);
+		void txComplete(boolean success);
+		void deliveryOutcome(boolean acked, uint8_t retries, uint32_t latency);
+		uint8_t adaptiveRetries(void);
+		void serviceDownlink(void);
+		uint16_t linkCheckInterval(void);
+		void linkCheckAnswer(const ll_lorawan_rx_t* rx);
+		void updateLinkHealth(boolean answered);
+		boolean dispatch(const uint8_t* buf, const ll_lorawan_rx_t* rx);
+		boolean dispatchGroup(const uint8_t* buf, const ll_lorawan_rx_t* rx);
+};
+
+
+#endif // SYMPHONYLINKLORAWAN_H
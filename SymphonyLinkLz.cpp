@@ -0,0 +1,205 @@
+#include "SymphonyLinkLz.h"
+#include <string.h>
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define LZ_DICT_BYTE(i)			pgm_read_byte(&lzDict[i])
+#else
+#define LZ_DICT_BYTE(i)			(lzDict[i])
+#endif
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+//Pre-shared with the cloud decoder; changing it breaks compatibility.
+//Frequent tokens go last where they are found first.
+static const char lzDict[] PROGMEM =
+	"DEBUG WARN INFO ERROR failed timeout retry reset connected disconnected "
+	"sensor battery voltage temperature humidity pressure interval version "
+	"config\":{\"id\":\"value\":\"time\":\"type\":\"name\":\"code\":"
+	"null,false,true,\"error\":\"status\":\"ok\"}";
+
+#define LZ_DICT_LEN				((int16_t)(sizeof(lzDict) - 1))
+
+
+//Byte at a window position; negative positions index the dictionary
+static uint8_t windowByte(const uint8_t* data, int16_t pos)
+{
+	return (pos < 0) ? (uint8_t)LZ_DICT_BYTE(LZ_DICT_LEN + pos) : data[pos];
+}
+
+bool lzIsCompressed(const uint8_t* buf, uint16_t len)
+{
+	return (len > 1) && ((buf[0] & LZ_MARKER_MASK) == LZ_MARKER);
+}
+
+uint16_t lzCompress(const uint8_t* in, uint16_t len, uint8_t* out, uint16_t out_size)
+{
+	uint16_t limit = (out_size < len) ? out_size : len;
+	uint16_t o = 1;
+	uint16_t flagPos = 0;
+	uint8_t item = 8;
+	int16_t i = 0;
+	int16_t j;
+	int16_t start;
+	uint16_t k;
+	uint16_t best;
+	uint16_t bestDist = 0;
+	uint16_t max;
+
+	if((len == 0) || (len > 0x7FFF) || (limit < 2))
+	{
+		return 0;
+	}
+
+	out[0] = LZ_MARKER | LZ_FLAG_DICT;
+
+	while(i < (int16_t)len)
+	{
+		//New flag byte every eight items
+		if(item == 8)
+		{
+			if(o >= limit)
+			{
+				return 0;
+			}
+			flagPos = o++;
+			out[flagPos] = 0;
+			item = 0;
+		}
+
+		max = len - i;
+		if(max > LZ_MAX_MATCH)
+		{
+			max = LZ_MAX_MATCH;
+		}
+
+		//Longest match in the window, nearest first
+		best = 0;
+		start = i - LZ_WINDOW;
+		if(start < -LZ_DICT_LEN)
+		{
+			start = -LZ_DICT_LEN;
+		}
+		for(j = i - 1; (j >= start) && (best < max); j--)
+		{
+			if((windowByte(in, j) != in[i]) ||
+			   ((best != 0) && (windowByte(in, j + best) != in[i + best])))
+			{
+				continue;
+			}
+			for(k = 1; (k < max) && (windowByte(in, j + k) == in[i + k]); k++)
+			{
+			}
+			if(k > best)
+			{
+				best = k;
+				bestDist = i - j;
+			}
+		}
+
+		if(best >= LZ_MIN_MATCH)
+		{
+			if(o + 2 > limit)
+			{
+				return 0;
+			}
+			out[flagPos] |= (uint8_t)(1 << item);
+			out[o++] = (uint8_t)((((bestDist - 1) >> 8) << 6) | (best - LZ_MIN_MATCH));
+			out[o++] = (uint8_t)(bestDist - 1);
+			i += best;
+		}
+		else
+		{
+			if(o + 1 > limit)
+			{
+				return 0;
+			}
+			out[o++] = in[i++];
+		}
+		item++;
+	}
+
+	//Only worth it when strictly shorter
+	return (o < len) ? o : 0;
+}
+
+uint16_t lzStore(const uint8_t* in, uint16_t len, uint8_t* out, uint16_t out_size)
+{
+	if(len + 1 > out_size)
+	{
+		return 0;
+	}
+	out[0] = LZ_MARKER;
+	memcpy(out + 1, in, len);
+	return len + 1;
+}
+
+int32_t lzDecompress(const uint8_t* in, uint16_t len, uint8_t* out, uint16_t out_size)
+{
+	uint16_t p;
+	uint16_t o = 0;
+	uint8_t flags = 0;
+	uint8_t item = 8;
+	uint16_t dist;
+	uint16_t n;
+	int32_t src;
+
+	if(!lzIsCompressed(in, len))
+	{
+		return -1;
+	}
+
+	//Stored frame
+	if((in[0] & LZ_FLAG_DICT) == 0)
+	{
+		if((uint16_t)(len - 1) > out_size)
+		{
+			return -1;
+		}
+		memcpy(out, in + 1, len - 1);
+		return len - 1;
+	}
+
+	p = 1;
+	while(p < len)
+	{
+		if(item == 8)
+		{
+			flags = in[p++];
+			item = 0;
+			continue;
+		}
+
+		if((flags & (1 << item++)) == 0)
+		{
+			if(o >= out_size)
+			{
+				return -1;
+			}
+			out[o++] = in[p++];
+			continue;
+		}
+
+		if(p + 2 > len)
+		{
+			return -1;
+		}
+		dist = (((uint16_t)(in[p] >> 6) << 8) | in[p + 1]) + 1;
+		n = (in[p] & 0x3F) + LZ_MIN_MATCH;
+		p += 2;
+
+		src = (int32_t)o - dist;
+		if((src < -LZ_DICT_LEN) || (o + n > out_size))
+		{
+			return -1;
+		}
+		while(n-- > 0)
+		{
+			out[o++] = windowByte(out, (int16_t)src++);
+		}
+	}
+
+	return o;
+}
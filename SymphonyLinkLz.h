@@ -0,0 +1,44 @@
+
+#ifndef SYMPHONYLINKLZ_H
+#define SYMPHONYLINKLZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * LZSS payload compression for short text and JSON-like uplinks.
+ *
+ * A compressed frame is LZ_MARKER | LZ_FLAG_DICT followed by groups of one
+ * flag byte and up to eight items, least significant flag bit first.  A clear
+ * bit is a literal byte, a set bit a two byte match:
+ *   [0] (distance - 1) >> 8 << 6 | (length - LZ_MIN_MATCH)
+ *   [1] (distance - 1) & 0xFF
+ * Distances reach back up to LZ_WINDOW bytes into the data already coded,
+ * with a static dictionary of common tokens logically in front of it, so even
+ * a first occurrence of "status" or "error" codes as a match.  The encoder
+ * needs no RAM beyond its stack frame; it searches the window directly.
+ * A payload that doesn't compress but starts with the marker nibble is sent
+ * as LZ_MARKER followed by the raw bytes, see lzStore().
+ * extras/symphony_lz.py decodes frames on the cloud side.
+ */
+
+#define LZ_MARKER				(0xD0)
+#define LZ_MARKER_MASK			(0xF0)
+#define LZ_FLAG_DICT			(0x01)
+
+#define LZ_WINDOW				(1024)
+#define LZ_MIN_MATCH			(3)
+#define LZ_MAX_MATCH			(LZ_MIN_MATCH + 63)
+
+//Compress into out, returns the frame length or 0 if it wouldn't be shorter
+uint16_t lzCompress(const uint8_t* in, uint16_t len, uint8_t* out, uint16_t out_size);
+
+//Decompress a frame, returns the payload length or -1 if malformed or too long
+int32_t lzDecompress(const uint8_t* in, uint16_t len, uint8_t* out, uint16_t out_size);
+
+//Escape an uncompressed payload, returns the frame length or 0 if it doesn't fit
+uint16_t lzStore(const uint8_t* in, uint16_t len, uint8_t* out, uint16_t out_size);
+
+bool lzIsCompressed(const uint8_t* buf, uint16_t len);
+
+#endif // SYMPHONYLINKLZ_H
@@ -0,0 +1,198 @@
+#include "SymphonyLinkModule.h"
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <poll.h>
+#endif
+
+
+//Response timeout applied by transport_read.  Shortened while polling for readiness.
+static uint32_t transport_timeout_ms = SL_TRANSPORT_TIMEOUT_MS;
+
+#if defined(__linux__)
+//Host interface used by transport_read/write, -1 for Serial1
+static int transport_fd = -1;
+
+void moduleSelectTransport(int fd)
+{
+	transport_fd = fd;
+}
+#endif
+
+boolean moduleWaitForReady(uint32_t timeout_ms, uint32_t* flags)
+{
+	uint32_t start = millis();
+	uint32_t irq;
+	int32_t ret;
+	
+	//Poll with a short response timeout.  While booting the module either doesn't
+	//answer at all or NACKs with BOOTUP_IN_PROGRESS; both mean try again.
+	transport_timeout_ms = SL_READY_POLL_TIMEOUT_MS;
+	
+	do
+	{
+		ret = ll_irq_flags(0, &irq);
+		if((ret >= 0) && ((irq & (IRQ_FLAGS_RESET | IRQ_FLAGS_INITIALIZATION_COMPLETE)) != 0))
+		{
+			transport_timeout_ms = SL_TRANSPORT_TIMEOUT_MS;
+			if(flags != NULL)
+			{
+				*flags = irq;
+			}
+			return true;
+		}
+		delay(SL_READY_POLL_INTERVAL_MS);
+	} while((millis() - start) < timeout_ms);
+	
+	transport_timeout_ms = SL_TRANSPORT_TIMEOUT_MS;
+	Serial.write("Error module not ready\n");
+	return false;
+}
+
+boolean moduleSetMacMode(ll_mac_type_t mode)
+{
+	ll_mac_type_t mac_mode;
+	uint32_t irq;
+	
+	if(0 > ll_mac_mode_get(&mac_mode))
+	{
+		Serial.write("Error ll_mac_mode_get\n");
+		return false;
+	}
+	if(mac_mode == mode)
+	{
+		return true;
+	}
+	
+	//Setting the mode reboots the module.  Both boot flags may still be set
+	//from the last boot; cleared, the readiness check only succeeds once the
+	//module has actually rebooted.
+	if(0 > ll_irq_flags(IRQ_FLAGS_RESET | IRQ_FLAGS_INITIALIZATION_COMPLETE, &irq))
+	{
+		Serial.write("Error ll_irq_flags\n");
+		return false;
+	}
+	
+	if(0 > ll_mac_mode_set(mode))
+	{
+		Serial.write("Error ll_mac_mode_set\n");
+		return false;
+	}
+	Serial.write("Setting MAC mode\n");
+	
+	return moduleWaitForReady();
+}
+
+
+#if defined(__linux__)
+static int32_t fd_write(const uint8_t* buf, uint16_t len)
+{
+	uint16_t done = 0;
+	ssize_t n;
+	
+	while(done < len)
+	{
+		n = ::write(transport_fd, buf + done, len - done);
+		if(n < 0)
+		{
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+static int32_t fd_read(uint8_t* buf, uint16_t len)
+{
+	struct pollfd pfd;
+	uint32_t start = millis();
+	int32_t remaining;
+	uint16_t done = 0;
+	ssize_t n;
+	
+	pfd.fd = transport_fd;
+	pfd.events = POLLIN;
+	
+	//Same contract as Serial1.readBytes: whatever arrived before the timeout
+	while(done < len)
+	{
+		remaining = (int32_t)(transport_timeout_ms - (millis() - start));
+		if((remaining <= 0) || (poll(&pfd, 1, remaining) <= 0))
+		{
+			break;
+		}
+		n = ::read(transport_fd, buf + done, len - done);
+		if(n <= 0)
+		{
+			break;
+		}
+		done += n;
+	}
+	return (done > 0) ? done : -1;
+}
+#endif
+
+int32_t transport_write(uint8_t* buf, uint16_t len)
+{
+	
+    int32_t ret;	
+	
+#if defined(__linux__)
+	if(transport_fd >= 0)
+	{
+		return fd_write(buf, len);
+	}
+#endif
+	
+    ret = Serial1.write(buf, len);
+	
+	
+    if (ret < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int32_t transport_read(uint8_t *buf, uint16_t len)
+{
+   
+	
+    uint8_t ret;
+   
+#if defined(__linux__)
+	if(transport_fd >= 0)
+	{
+		return fd_read(buf, len);
+	}
+#endif
+	
+	Serial1.setTimeout(transport_timeout_ms);
+	ret = Serial1.readBytes(buf, len); 
+
+	if (ret > 0) 
+	{
+			return(ret);
+	}
+	else
+	{
+		  return(-1);
+	}
+}
+
+//Used by the blocking LoRaWAN activation calls in ll_ifc_lorawan.c
+int32_t gettime(struct time *tp)
+{
+	uint32_t ms = millis();
+	
+	tp->tv_sec = ms / 1000;
+	tp->tv_nsec = (ms % 1000) * 1000000L;
+	return 0;
+}
+
+int32_t sleep_ms(int32_t ms)
+{
+	delay(ms);
+	return 0;
+}
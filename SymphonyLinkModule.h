@@ -0,0 +1,43 @@
+
+#ifndef SYMPHONYLINKMODULE_H
+#define SYMPHONYLINKMODULE_H
+
+
+#include "arduino.h"
+#include "ll_ifc.h"
+#include "ll_ifc_consts.h"
+
+//Host interface response timeout used for normal commands
+#define SL_TRANSPORT_TIMEOUT_MS		(500)
+
+//Readiness detection: poll the module with a short response timeout until it
+//reports it has finished booting, giving up after SL_READY_TIMEOUT_MS
+#define SL_READY_TIMEOUT_MS			(5000)
+#define SL_READY_POLL_TIMEOUT_MS	(20)
+#define SL_READY_POLL_INTERVAL_MS	(10)
+
+/*
+ * Host side of the module, shared by SymphonyLink and LoRaWANLink: the
+ * transport the ll_ifc layer talks through, and the boot and MAC mode
+ * handling that goes with it.
+ *
+ * A module reports RESET and INITIALIZATION_COMPLETE once it has booted.
+ * Both stay latched until cleared, so a MAC mode change clears them before
+ * the module reboots; only then does either one mean the new boot is done.
+ */
+
+#if defined(__linux__)
+//Host UART used for the following commands, -1 for Serial1.  The ll_ifc
+//layer has no notion of a module, so each instance selects its own port
+//before talking to it.
+void moduleSelectTransport(int fd);
+#endif
+
+//Wait until the module answers and reports it has booted.  flags, if given,
+//receives its IRQ flags.
+boolean moduleWaitForReady(uint32_t timeout_ms = SL_READY_TIMEOUT_MS, uint32_t* flags = NULL);
+
+//Put the module in mode, waiting for the reboot that takes
+boolean moduleSetMacMode(ll_mac_type_t mode);
+
+#endif // SYMPHONYLINKMODULE_H
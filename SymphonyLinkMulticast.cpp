@@ -0,0 +1,206 @@
+#include "SymphonyLinkMulticast.h"
+#include <string.h>
+
+
+MulticastGroups::MulticastGroups()
+{
+	uint8_t i;
+
+	for(i = 0; i < MCAST_MAX_GROUPS; i++)
+	{
+		_groups[i].id = 0;
+		_groups[i].used = false;
+		_groups[i].synced = false;
+		_groups[i].last = 0;
+		_groups[i].seen = 0;
+	}
+	_duplicates = 0;
+}
+
+bool MulticastGroups::join(uint8_t group, uint8_t* buf, uint16_t size)
+{
+	mcastGroup* g = find(group);
+	uint8_t i;
+
+	//Joining again only swaps the buffer
+	if(g == NULL)
+	{
+		for(i = 0; (i < MCAST_MAX_GROUPS) && _groups[i].used; i++)
+		{
+		}
+		if(i == MCAST_MAX_GROUPS)
+		{
+			return false;
+		}
+		g = &_groups[i];
+		g->id = group;
+		g->used = true;
+		g->synced = false;
+		g->last = 0;
+		g->seen = 0;
+	}
+	g->frag.begin(buf, size);
+	return true;
+}
+
+bool MulticastGroups::leave(uint8_t group)
+{
+	mcastGroup* g = find(group);
+
+	if(g == NULL)
+	{
+		return false;
+	}
+	g->used = false;
+	g->frag.begin(NULL, 0);
+	return true;
+}
+
+bool MulticastGroups::member(uint8_t group)
+{
+	return find(group) != NULL;
+}
+
+McastResult MulticastGroups::push(const uint8_t* frame, uint16_t len, uint32_t now, uint8_t* group,
+								  const uint8_t** payload, uint16_t* payload_len)
+{
+	mcastGroup* g;
+	uint8_t type;
+	uint16_t seq;
+
+	if((len < MCAST_HEADER_LEN) || ((frame[0] & MCAST_MARKER_MASK) != MCAST_MARKER))
+	{
+		return MCAST_NONE;
+	}
+
+	type = frame[0] & ~MCAST_MARKER_MASK;
+	if((type != MCAST_DATA) && (type != MCAST_FRAG))
+	{
+		return MCAST_NONE;
+	}
+
+	*group = frame[1];
+	g = find(frame[1]);
+	if(g == NULL)
+	{
+		return MCAST_IGNORED;
+	}
+
+	seq = ((uint16_t)frame[2] << 8) | frame[3];
+	if(!fresh(g, seq))
+	{
+		_duplicates++;
+		return MCAST_DUPLICATE;
+	}
+
+	if(type == MCAST_DATA)
+	{
+		*payload = frame + MCAST_HEADER_LEN;
+		*payload_len = len - MCAST_HEADER_LEN;
+		return MCAST_DELIVER;
+	}
+
+	//Nobody is asked for an ack, ackNeeded() is left alone
+	switch(g->frag.push(frame + MCAST_HEADER_LEN, len - MCAST_HEADER_LEN, now))
+	{
+		case FRAG_COMPLETE:
+			*payload = g->frag.data();
+			*payload_len = g->frag.length();
+			return MCAST_DELIVER;
+
+		case FRAG_PENDING:
+			return MCAST_PENDING;
+
+		default:
+			return MCAST_ERROR;
+	}
+}
+
+void MulticastGroups::poll(uint32_t now, uint32_t timeout_ms)
+{
+	uint8_t i;
+
+	for(i = 0; i < MCAST_MAX_GROUPS; i++)
+	{
+		if(_groups[i].used)
+		{
+			_groups[i].frag.poll(now, timeout_ms);
+		}
+	}
+}
+
+uint16_t MulticastGroups::buildStatus(uint8_t group, uint8_t* out, uint16_t out_len)
+{
+	mcastGroup* g = find(group);
+	uint16_t ackLen;
+
+	if((g == NULL) || !g->synced || (out_len <= MCAST_HEADER_LEN))
+	{
+		return 0;
+	}
+
+	ackLen = g->frag.buildAck(out + MCAST_HEADER_LEN, out_len - MCAST_HEADER_LEN);
+	if(ackLen == 0)
+	{
+		return 0;
+	}
+
+	out[0] = MCAST_MARKER | MCAST_STATUS;
+	out[1] = group;
+	out[2] = (uint8_t)(g->last >> 8);
+	out[3] = (uint8_t)(g->last);
+	return MCAST_HEADER_LEN + ackLen;
+}
+
+uint32_t MulticastGroups::duplicates(void)
+{
+	return _duplicates;
+}
+
+MulticastGroups::mcastGroup* MulticastGroups::find(uint8_t group)
+{
+	uint8_t i;
+
+	for(i = 0; i < MCAST_MAX_GROUPS; i++)
+	{
+		if(_groups[i].used && (_groups[i].id == group))
+		{
+			return &_groups[i];
+		}
+	}
+	return NULL;
+}
+
+//Marks seq heard, false if it was already
+bool MulticastGroups::fresh(mcastGroup* g, uint16_t seq)
+{
+	int16_t diff = (int16_t)(seq - g->last);
+
+	//The first frame, or the sender restarted its count
+	if(!g->synced || (diff < -MCAST_RESTART_DISTANCE))
+	{
+		g->synced = true;
+		g->last = seq;
+		g->seen = 1;
+		return true;
+	}
+
+	if(diff > 0)
+	{
+		g->seen = (diff < MCAST_SEEN_WINDOW) ? ((g->seen << diff) | 1) : 1;
+		g->last = seq;
+		return true;
+	}
+
+	//Too far behind to tell counts as heard
+	if(-diff >= MCAST_SEEN_WINDOW)
+	{
+		return false;
+	}
+	if((g->seen & ((uint32_t)1 << -diff)) != 0)
+	{
+		return false;
+	}
+	g->seen |= (uint32_t)1 << -diff;
+	return true;
+}
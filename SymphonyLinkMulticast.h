@@ -0,0 +1,114 @@
+
+#ifndef SYMPHONYLINKMULTICAST_H
+#define SYMPHONYLINKMULTICAST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "SymphonyLinkFrag.h"
+
+/*
+ * Application level groups on top of LoRaWAN multicast downlinks.
+ *
+ * The module only says a downlink arrived over a multicast session, not
+ * which one, so a group frame names its group itself:
+ *   [0] MCAST_MARKER | type
+ *   [1] group id
+ *   [2] sequence number, high byte
+ *   [3] sequence number, low byte
+ * followed by the message for MCAST_DATA, or by a fragment as laid out in
+ * SymphonyLinkFrag.h for MCAST_FRAG.  Every transmission to a group takes
+ * the group's next sequence number.
+ *
+ * Frames for groups not joined are left to the caller.  A bitset of the last
+ * MCAST_SEEN_WINDOW sequence numbers per group drops frames heard twice,
+ * e.g. from more than one gateway; a sequence number further behind than
+ * MCAST_RESTART_DISTANCE means the sender restarted its count.  Nothing in
+ * a frame says so otherwise, so a sender that restarts less than that
+ * distance behind its last number has up to MCAST_RESTART_DISTANCE frames
+ * dropped as old until its count passes the last one heard; a sender keeps
+ * its count across restarts, or jumps it ahead.  Fragments are reassembled
+ * per group into a buffer given to join().  Nobody answers
+ * a multicast, so the sender repeats a transfer in rounds and each device
+ * fills in what it missed; buildStatus() gives a device that still lacks
+ * fragments a frame to uplink for a unicast repair:
+ *   [0] MCAST_MARKER | MCAST_STATUS
+ *   [1] group id
+ *   [2..3] last sequence number heard
+ *   [4..] fragment ack of the group's transfer (SymphonyLinkFrag.h)
+ * extras/symphony_mcast.py is the matching cloud side.
+ */
+
+#define MCAST_MARKER			(0xC0)
+#define MCAST_MARKER_MASK		(0xF0)
+#define MCAST_DATA				(0x01)
+#define MCAST_FRAG				(0x02)
+#define MCAST_STATUS			(0x03)
+#define MCAST_HEADER_LEN		(4)
+
+#define MCAST_SEEN_WINDOW		(32)
+#define MCAST_RESTART_DISTANCE	(1024)
+
+#ifndef MCAST_MAX_GROUPS
+#if defined(__AVR__)
+#define MCAST_MAX_GROUPS		(2)
+#else
+#define MCAST_MAX_GROUPS		(4)
+#endif
+#endif
+
+enum McastResult
+{
+	MCAST_NONE = 0,			//no group header
+	MCAST_DELIVER,			//a message for a joined group
+	MCAST_PENDING,			//fragment taken, transfer not complete yet
+	MCAST_DUPLICATE,		//heard already, drop
+	MCAST_IGNORED,			//for a group not joined
+	MCAST_ERROR				//malformed, or the transfer doesn't fit
+};
+
+class MulticastGroups {
+
+	public:
+
+		MulticastGroups();
+
+		//buf receives fragmented transfers to the group, NULL if it gets none
+		bool join(uint8_t group, uint8_t* buf, uint16_t size);
+		bool leave(uint8_t group);
+		bool member(uint8_t group);
+
+		//Feed a multicast downlink.  On MCAST_DELIVER *payload points to the
+		//message: in frame for MCAST_DATA, in the group's buffer for a
+		//completed transfer.
+		McastResult push(const uint8_t* frame, uint16_t len, uint32_t now, uint8_t* group,
+						 const uint8_t** payload, uint16_t* payload_len);
+
+		//Drop transfers that have been silent longer than timeout_ms
+		void poll(uint32_t now, uint32_t timeout_ms);
+
+		//Repair request for the group's transfer, 0 for a group not joined or
+		//not heard from yet, or when out_len is too short
+		uint16_t buildStatus(uint8_t group, uint8_t* out, uint16_t out_len);
+
+		uint32_t duplicates(void);
+
+	private:
+
+		typedef struct
+		{
+			uint8_t id;
+			bool used;
+			bool synced;
+			uint16_t last;			//newest sequence number heard
+			uint32_t seen;			//bit i: last - i was heard
+			FragmentReceiver frag;
+		} mcastGroup;
+
+		mcastGroup _groups[MCAST_MAX_GROUPS];
+		uint32_t _duplicates;
+
+		mcastGroup* find(uint8_t group);
+		bool fresh(mcastGroup* g, uint16_t seq);
+};
+
+#endif // SYMPHONYLINKMULTICAST_H
@@ -0,0 +1,431 @@
+#include "SymphonyLinkPack.h"
+#include <string.h>
+
+//Marks the XOR window as unset so the first float writes its own
+#define PACK_NO_WINDOW			(0xFF)
+
+
+static uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static uint8_t leadingZeros(uint32_t v)
+{
+	uint8_t n = 0;
+
+	while((n < 32) && ((v & 0x80000000UL) == 0))
+	{
+		v <<= 1;
+		n++;
+	}
+	return n;
+}
+
+static uint8_t trailingZeros(uint32_t v)
+{
+	uint8_t n = 0;
+
+	while((n < 32) && ((v & 1) == 0))
+	{
+		v >>= 1;
+		n++;
+	}
+	return n;
+}
+
+
+SeriesPacker::SeriesPacker()
+{
+	_buf = NULL;
+	_size = 0;
+	_bit = 0;
+	_type = SERIES_INT;
+	_count = 0;
+	_prevTime = 0;
+	_prevDelta = 0;
+	_prevValue = 0;
+	_leading = PACK_NO_WINDOW;
+	_trailing = 0;
+}
+
+bool SeriesPacker::begin(uint8_t* buf, uint16_t size, SeriesType type)
+{
+	if((buf == NULL) || (size <= PACK_HEADER_LEN))
+	{
+		return false;
+	}
+
+	_buf = buf;
+	_size = size;
+	_bit = 0;
+	_type = type;
+	_count = 0;
+	_prevDelta = 0;
+	_leading = PACK_NO_WINDOW;
+	_trailing = 0;
+
+	memset(buf, 0, PACK_HEADER_LEN);
+	buf[0] = (PACK_VERSION << 4) | (uint8_t)type;
+	return true;
+}
+
+bool SeriesPacker::add(uint32_t timestamp, int32_t value)
+{
+	return (_type == SERIES_INT) && addSample(timestamp, (uint32_t)value);
+}
+
+bool SeriesPacker::add(uint32_t timestamp, float value)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	return (_type == SERIES_FLOAT) && addSample(timestamp, bits);
+}
+
+uint16_t SeriesPacker::length(void)
+{
+	return (_count == 0) ? 0 : (uint16_t)(PACK_HEADER_LEN + (_bit + 7) / 8);
+}
+
+uint8_t SeriesPacker::count(void)
+{
+	return _count;
+}
+
+bool SeriesPacker::addSample(uint32_t timestamp, uint32_t bits)
+{
+	uint32_t bit = _bit;
+	int32_t prevDelta = _prevDelta;
+	uint8_t leading = _leading;
+	uint8_t trailing = _trailing;
+	int32_t delta;
+	bool ok;
+
+	if((_buf == NULL) || (_count >= PACK_MAX_SAMPLES))
+	{
+		return false;
+	}
+
+	if(_count == 0)
+	{
+		_buf[2] = (uint8_t)(timestamp >> 24);
+		_buf[3] = (uint8_t)(timestamp >> 16);
+		_buf[4] = (uint8_t)(timestamp >> 8);
+		_buf[5] = (uint8_t)(timestamp);
+		ok = writeBits(bits, 32);
+	}
+	else
+	{
+		delta = (int32_t)(timestamp - _prevTime);
+		ok = writeVarint((int32_t)((uint32_t)delta - (uint32_t)_prevDelta));
+		if(ok)
+		{
+			_prevDelta = delta;
+			if(_type == SERIES_INT)
+			{
+				ok = writeVarint((int32_t)(bits - _prevValue));
+			}
+			else
+			{
+				ok = writeXor(bits);
+			}
+		}
+	}
+
+	if(!ok)
+	{
+		//Doesn't fit, leave the frame as it was
+		_bit = bit;
+		_prevDelta = prevDelta;
+		_leading = leading;
+		_trailing = trailing;
+		return false;
+	}
+
+	_prevTime = timestamp;
+	_prevValue = bits;
+	_count++;
+	_buf[1] = _count;
+	return true;
+}
+
+bool SeriesPacker::writeBits(uint32_t value, uint8_t n)
+{
+	uint8_t* p;
+	uint8_t mask;
+
+	if(PACK_HEADER_LEN + (_bit + n + 7) / 8 > _size)
+	{
+		return false;
+	}
+
+	while(n > 0)
+	{
+		n--;
+		p = &_buf[PACK_HEADER_LEN + (_bit >> 3)];
+		mask = (uint8_t)(0x80 >> (_bit & 7));
+		if((value >> n) & 1)
+		{
+			*p |= mask;
+		}
+		else
+		{
+			*p &= (uint8_t)~mask;
+		}
+		_bit++;
+	}
+	return true;
+}
+
+bool SeriesPacker::writeVarint(int32_t value)
+{
+	uint32_t v = zigzag(value);
+
+	while(v >= 0x80)
+	{
+		if(!writeBits((v & 0x7F) | 0x80, 8))
+		{
+			return false;
+		}
+		v >>= 7;
+	}
+	return writeBits(v, 8);
+}
+
+bool SeriesPacker::writeXor(uint32_t bits)
+{
+	uint32_t x = bits ^ _prevValue;
+	uint8_t lz;
+	uint8_t tz;
+
+	if(x == 0)
+	{
+		return writeBits(0, 1);
+	}
+
+	lz = leadingZeros(x);
+	tz = trailingZeros(x);
+
+	//Reuse the previous window when the meaningful bits fall inside it
+	if((_leading != PACK_NO_WINDOW) && (lz >= _leading) && (tz >= _trailing))
+	{
+		return writeBits(0x2, 2) &&
+			   writeBits(x >> _trailing, 32 - _leading - _trailing);
+	}
+
+	_leading = lz;
+	_trailing = tz;
+	return writeBits(0x3, 2) &&
+		   writeBits(lz, 5) &&
+		   writeBits(32 - lz - tz - 1, 5) &&
+		   writeBits(x >> tz, 32 - lz - tz);
+}
+
+
+SeriesUnpacker::SeriesUnpacker()
+{
+	_buf = NULL;
+	_len = 0;
+	_bit = 0;
+	_type = SERIES_INT;
+	_count = 0;
+	_index = 0;
+	_prevTime = 0;
+	_prevDelta = 0;
+	_prevValue = 0;
+	_leading = PACK_NO_WINDOW;
+	_trailing = 0;
+}
+
+bool SeriesUnpacker::begin(const uint8_t* buf, uint16_t len)
+{
+	if((buf == NULL) || (len < PACK_HEADER_LEN) || ((buf[0] >> 4) != PACK_VERSION) ||
+	   ((buf[0] & 0x0F) > SERIES_FLOAT))
+	{
+		return false;
+	}
+
+	_buf = buf;
+	_len = len;
+	_bit = 0;
+	_type = (SeriesType)(buf[0] & 0x0F);
+	_count = buf[1];
+	_index = 0;
+	_prevTime = ((uint32_t)buf[2] << 24) | ((uint32_t)buf[3] << 16) | ((uint32_t)buf[4] << 8) | buf[5];
+	_prevDelta = 0;
+	_prevValue = 0;
+	_leading = PACK_NO_WINDOW;
+	_trailing = 0;
+	return true;
+}
+
+SeriesType SeriesUnpacker::type(void)
+{
+	return _type;
+}
+
+uint8_t SeriesUnpacker::count(void)
+{
+	return _count;
+}
+
+bool SeriesUnpacker::next(uint32_t* timestamp, int32_t* value)
+{
+	uint32_t bits;
+
+	if((_type != SERIES_INT) || !nextSample(timestamp, &bits))
+	{
+		return false;
+	}
+	*value = (int32_t)bits;
+	return true;
+}
+
+bool SeriesUnpacker::next(uint32_t* timestamp, float* value)
+{
+	uint32_t bits;
+
+	if((_type != SERIES_FLOAT) || !nextSample(timestamp, &bits))
+	{
+		return false;
+	}
+	memcpy(value, &bits, sizeof(bits));
+	return true;
+}
+
+bool SeriesUnpacker::nextSample(uint32_t* timestamp, uint32_t* bits)
+{
+	int32_t dod;
+	int32_t delta;
+
+	if((_buf == NULL) || (_index >= _count))
+	{
+		return false;
+	}
+
+	if(_index == 0)
+	{
+		if(!readBits(bits, 32))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		if(!readVarint(&dod))
+		{
+			return false;
+		}
+		_prevDelta = (int32_t)((uint32_t)_prevDelta + (uint32_t)dod);
+		_prevTime += (uint32_t)_prevDelta;
+
+		if(_type == SERIES_INT)
+		{
+			if(!readVarint(&delta))
+			{
+				return false;
+			}
+			*bits = _prevValue + (uint32_t)delta;
+		}
+		else if(!readXor(bits))
+		{
+			return false;
+		}
+	}
+
+	*timestamp = _prevTime;
+	_prevValue = *bits;
+	_index++;
+	return true;
+}
+
+bool SeriesUnpacker::readBits(uint32_t* value, uint8_t n)
+{
+	uint32_t v = 0;
+
+	if(PACK_HEADER_LEN + (_bit + n + 7) / 8 > _len)
+	{
+		return false;
+	}
+
+	while(n > 0)
+	{
+		n--;
+		v = (v << 1) | ((_buf[PACK_HEADER_LEN + (_bit >> 3)] >> (7 - (_bit & 7))) & 1);
+		_bit++;
+	}
+	*value = v;
+	return true;
+}
+
+bool SeriesUnpacker::readVarint(int32_t* value)
+{
+	uint32_t v = 0;
+	uint32_t group;
+	uint8_t shift;
+
+	for(shift = 0; shift < 35; shift += 7)
+	{
+		if(!readBits(&group, 8))
+		{
+			return false;
+		}
+		v |= (group & 0x7F) << shift;
+		if((group & 0x80) == 0)
+		{
+			*value = unzigzag(v);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SeriesUnpacker::readXor(uint32_t* bits)
+{
+	uint32_t flag;
+	uint32_t lz;
+	uint32_t len;
+	uint32_t x;
+
+	if(!readBits(&flag, 1))
+	{
+		return false;
+	}
+	if(flag == 0)
+	{
+		*bits = _prevValue;
+		return true;
+	}
+
+	if(!readBits(&flag, 1))
+	{
+		return false;
+	}
+
+	if(flag != 0)
+	{
+		if(!readBits(&lz, 5) || !readBits(&len, 5) || (lz + len + 1 > 32))
+		{
+			return false;
+		}
+		_leading = (uint8_t)lz;
+		_trailing = (uint8_t)(32 - lz - len - 1);
+	}
+	else if(_leading == PACK_NO_WINDOW)
+	{
+		return false;
+	}
+
+	if(!readBits(&x, 32 - _leading - _trailing))
+	{
+		return false;
+	}
+	*bits = _prevValue ^ (x << _trailing);
+	return true;
+}
@@ -0,0 +1,104 @@
+
+#ifndef SYMPHONYLINKPACK_H
+#define SYMPHONYLINKPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Compact encoding of timestamped sensor series for uplink payloads.
+ *
+ * A packed frame starts with a 6 byte header:
+ *   [0] PACK_VERSION << 4 | series type
+ *   [1] sample count
+ *   [2..5] first timestamp, big endian
+ * followed by a bit stream.  The first value is stored raw in 32 bits.  For
+ * every later sample the timestamp is stored as the zig-zag varint of its
+ * delta-of-delta, so a steady sampling period costs one byte.  Integer values
+ * are stored as the zig-zag varint of their delta.  Float values use Gorilla
+ * XOR compression: a single 0 bit when the value repeats, otherwise the
+ * meaningful bits of the XOR with the previous value, reusing the previous
+ * leading/trailing zero window when it fits.  Readings with a fixed
+ * resolution (e.g. 0.1 degrees) pack far better as scaled integers.
+ *
+ * add() returns false, leaving the frame unchanged, once a sample no longer
+ * fits; send length() bytes and begin() a new frame.
+ */
+
+#define PACK_VERSION			(1)
+#define PACK_HEADER_LEN			(6)
+#define PACK_MAX_SAMPLES		(255)
+
+enum SeriesType
+{
+	SERIES_INT = 0,
+	SERIES_FLOAT
+};
+
+class SeriesPacker {
+
+	public:
+
+		SeriesPacker();
+
+		bool begin(uint8_t* buf, uint16_t size, SeriesType type);
+		bool add(uint32_t timestamp, int32_t value);
+		bool add(uint32_t timestamp, float value);
+
+		uint16_t length(void);
+		uint8_t count(void);
+
+	private:
+
+		uint8_t* _buf;
+		uint16_t _size;
+		uint32_t _bit;				//write position in bits
+		SeriesType _type;
+		uint8_t _count;
+		uint32_t _prevTime;
+		int32_t _prevDelta;
+		uint32_t _prevValue;		//raw bits of the previous value
+		uint8_t _leading;			//XOR window of the previous float
+		uint8_t _trailing;
+
+		bool addSample(uint32_t timestamp, uint32_t bits);
+		bool writeBits(uint32_t value, uint8_t n);
+		bool writeVarint(int32_t value);
+		bool writeXor(uint32_t bits);
+};
+
+class SeriesUnpacker {
+
+	public:
+
+		SeriesUnpacker();
+
+		bool begin(const uint8_t* buf, uint16_t len);
+		SeriesType type(void);
+		uint8_t count(void);
+
+		//Next sample, false when the frame is exhausted or malformed
+		bool next(uint32_t* timestamp, int32_t* value);
+		bool next(uint32_t* timestamp, float* value);
+
+	private:
+
+		const uint8_t* _buf;
+		uint16_t _len;
+		uint32_t _bit;
+		SeriesType _type;
+		uint8_t _count;
+		uint8_t _index;
+		uint32_t _prevTime;
+		int32_t _prevDelta;
+		uint32_t _prevValue;
+		uint8_t _leading;
+		uint8_t _trailing;
+
+		bool nextSample(uint32_t* timestamp, uint32_t* bits);
+		bool readBits(uint32_t* value, uint8_t n);
+		bool readVarint(int32_t* value);
+		bool readXor(uint32_t* bits);
+};
+
+#endif // SYMPHONYLINKPACK_H
@@ -0,0 +1,14 @@
+
+#ifndef SYMPHONYLINKPRIORITY_H
+#define SYMPHONYLINKPRIORITY_H
+
+//Uplink classes, shared by SymphonyLink and LoRaWANLink
+enum Priority
+{
+	PRIORITY_HIGH = 0,		//alarms: sent next, ahead of everything queued
+	PRIORITY_NORMAL,
+	PRIORITY_BULK,			//held while the link is degraded
+	NUM_PRIORITIES
+};
+
+#endif // SYMPHONYLINKPRIORITY_H
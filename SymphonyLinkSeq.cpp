@@ -0,0 +1,253 @@
+#include "SymphonyLinkSeq.h"
+#include <string.h>
+
+
+DownlinkSequencer::DownlinkSequencer()
+{
+	reset();
+}
+
+void DownlinkSequencer::reset(void)
+{
+	memset(_streams, 0, sizeof(_streams));
+	_duplicates = 0;
+}
+
+SeqResult DownlinkSequencer::push(uint8_t* buf, uint8_t* len, uint32_t now, uint8_t* stream)
+{
+	seqStream* s;
+	uint8_t id;
+	uint16_t seq;
+	int16_t diff;
+	int8_t slot;
+	uint8_t i;
+	uint8_t tmp;
+	uint8_t heldLen;
+	uint16_t heldSeq;
+
+	if((*len < SEQ_HEADER_LEN) || ((buf[0] & SEQ_MARKER_MASK) != SEQ_MARKER))
+	{
+		*stream = SEQ_NO_STREAM;
+		return SEQ_NONE;
+	}
+
+	id = buf[0] & ~SEQ_MARKER_MASK;
+	seq = ((uint16_t)buf[1] << 8) | buf[2];
+	*len -= SEQ_HEADER_LEN;
+	memmove(buf, buf + SEQ_HEADER_LEN, *len);
+	*stream = id;
+
+	//Streams beyond what we track are delivered unordered
+	if(id >= SEQ_MAX_STREAMS)
+	{
+		return SEQ_DELIVER;
+	}
+
+	s = &_streams[id];
+	if(!s->active)
+	{
+		memset(s, 0, sizeof(*s));
+		s->active = true;
+		s->next = seq;
+	}
+
+	diff = (int16_t)(seq - s->next);
+
+	if(diff < 0)
+	{
+		if(-diff <= SEQ_SEEN_WINDOW)
+		{
+			if((s->seen & ((uint32_t)1 << (-diff - 1))) != 0)
+			{
+				_duplicates++;
+				return SEQ_DUPLICATE;
+			}
+			//A skipped message turning up late
+			s->seen |= (uint32_t)1 << (-diff - 1);
+			return SEQ_DELIVER;
+		}
+
+		if(-diff <= SEQ_RESTART_DISTANCE)
+		{
+			_duplicates++;
+			return SEQ_DUPLICATE;
+		}
+
+		//Far behind: the sender restarted its sequence
+		memset(s, 0, sizeof(*s));
+		s->active = true;
+		s->next = seq;
+		diff = 0;
+	}
+
+	if(diff == 0)
+	{
+		delivered(s, now);
+		return SEQ_DELIVER;
+	}
+
+	slot = -1;
+	for(i = 0; i < SEQ_HOLD_SLOTS; i++)
+	{
+		if(s->held[i].used)
+		{
+			if(s->held[i].seq == seq)
+			{
+				_duplicates++;
+				return SEQ_DUPLICATE;
+			}
+		}
+		else if(slot < 0)
+		{
+			slot = i;
+		}
+	}
+
+	//Too long to hold: give up on the gap as when out of hold slots, so it is
+	//delivered in order and a copy of it counts as a duplicate.  A message
+	//held from before it has to go first, so then it can only be dropped.
+	if(*len > SEQ_MSG_LEN)
+	{
+		slot = oldestHeld(s);
+		if((slot >= 0) && ((int16_t)(s->held[slot].seq - seq) < 0))
+		{
+			return SEQ_DROPPED;
+		}
+		skipTo(s, seq);
+		delivered(s, now);
+		return SEQ_DELIVER;
+	}
+
+	if(slot >= 0)
+	{
+		if(oldestHeld(s) < 0)
+		{
+			s->gapSince = now;
+		}
+		s->held[slot].seq = seq;
+		s->held[slot].len = *len;
+		s->held[slot].used = true;
+		memcpy(s->held[slot].data, buf, *len);
+		return SEQ_HELD;
+	}
+
+	//Out of hold slots: give up on the gap and deliver the oldest message
+	//we have, swapping it with the new one when that one is held instead
+	slot = oldestHeld(s);
+	if((int16_t)(s->held[slot].seq - seq) < 0)
+	{
+		heldLen = s->held[slot].len;
+		heldSeq = s->held[slot].seq;
+		for(i = 0; (i < heldLen) || (i < *len); i++)
+		{
+			tmp = buf[i];
+			buf[i] = s->held[slot].data[i];
+			s->held[slot].data[i] = tmp;
+		}
+		s->held[slot].seq = seq;
+		s->held[slot].len = *len;
+		seq = heldSeq;
+		*len = heldLen;
+	}
+
+	skipTo(s, seq);
+	delivered(s, now);
+	return SEQ_DELIVER;
+}
+
+bool DownlinkSequencer::pop(uint8_t* buf, uint8_t* len, uint8_t* stream, uint32_t now)
+{
+	seqStream* s;
+	uint8_t id;
+	uint8_t i;
+
+	for(id = 0; id < SEQ_MAX_STREAMS; id++)
+	{
+		s = &_streams[id];
+		for(i = 0; i < SEQ_HOLD_SLOTS; i++)
+		{
+			if(s->held[i].used && (s->held[i].seq == s->next))
+			{
+				memcpy(buf, s->held[i].data, s->held[i].len);
+				*len = s->held[i].len;
+				*stream = id;
+				s->held[i].used = false;
+				delivered(s, now);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void DownlinkSequencer::poll(uint32_t now, uint32_t timeout_ms)
+{
+	seqStream* s;
+	int8_t slot;
+	uint8_t id;
+
+	for(id = 0; id < SEQ_MAX_STREAMS; id++)
+	{
+		s = &_streams[id];
+		slot = oldestHeld(s);
+		if((slot >= 0) && ((now - s->gapSince) >= timeout_ms))
+		{
+			skipTo(s, s->held[slot].seq);
+			s->gapSince = now;
+		}
+	}
+}
+
+bool DownlinkSequencer::gapDeadline(uint32_t timeout_ms, uint32_t* at)
+{
+	bool found = false;
+	uint8_t id;
+
+	for(id = 0; id < SEQ_MAX_STREAMS; id++)
+	{
+		if((oldestHeld(&_streams[id]) >= 0) &&
+		   (!found || ((int32_t)(_streams[id].gapSince + timeout_ms - *at) < 0)))
+		{
+			*at = _streams[id].gapSince + timeout_ms;
+			found = true;
+		}
+	}
+	return found;
+}
+
+uint32_t DownlinkSequencer::duplicates(void)
+{
+	return _duplicates;
+}
+
+void DownlinkSequencer::delivered(seqStream* s, uint32_t now)
+{
+	s->seen = (s->seen << 1) | 1;
+	s->next++;
+	s->gapSince = now;
+}
+
+void DownlinkSequencer::skipTo(seqStream* s, uint16_t seq)
+{
+	uint16_t gap = seq - s->next;
+
+	//Skipped sequence numbers stay clear in the seen window
+	s->seen = (gap >= SEQ_SEEN_WINDOW) ? 0 : (s->seen << gap);
+	s->next = seq;
+}
+
+int8_t DownlinkSequencer::oldestHeld(seqStream* s)
+{
+	int8_t oldest = -1;
+	uint8_t i;
+
+	for(i = 0; i < SEQ_HOLD_SLOTS; i++)
+	{
+		if(s->held[i].used &&
+		   ((oldest < 0) || ((int16_t)(s->held[i].seq - s->held[oldest].seq) < 0)))
+		{
+			oldest = i;
+		}
+	}
+	return oldest;
+}
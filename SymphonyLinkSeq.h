@@ -0,0 +1,108 @@
+
+#ifndef SYMPHONYLINKSEQ_H
+#define SYMPHONYLINKSEQ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Downlink duplicate suppression and per-stream ordering.
+ *
+ * Sequenced downlinks start with a 3 byte header:
+ *   [0] SEQ_MARKER | stream
+ *   [1] sequence number, high byte
+ *   [2] sequence number, low byte
+ *
+ * Each stream delivers in sequence order.  Messages that arrive ahead of a
+ * gap are held until the gap fills, the gap times out or the stream runs out
+ * of hold slots; the gap is then skipped.  A bitset of the last
+ * SEQ_SEEN_WINDOW sequence numbers behind the next expected one tells
+ * redelivered duplicates (dropped) apart from late arrivals of skipped
+ * messages (delivered late rather than lost).  A sequence number further
+ * behind than SEQ_RESTART_DISTANCE means the sender restarted its count.
+ * A message longer than SEQ_MSG_LEN can't be held, so one that arrives ahead
+ * of a gap skips the gap at once, or is dropped if an older message is held.
+ */
+
+#define SEQ_MARKER				(0xE0)
+#define SEQ_MARKER_MASK			(0xF0)
+#define SEQ_HEADER_LEN			(3)
+
+#define SEQ_SEEN_WINDOW			(32)
+#define SEQ_RESTART_DISTANCE	(1024)
+
+#ifndef SEQ_MAX_STREAMS
+#if defined(__AVR__)
+#define SEQ_MAX_STREAMS			(2)
+#define SEQ_HOLD_SLOTS			(1)
+#define SEQ_MSG_LEN				(32)
+#else
+#define SEQ_MAX_STREAMS			(4)
+#define SEQ_HOLD_SLOTS			(4)
+#define SEQ_MSG_LEN				(128)
+#endif
+#endif
+
+//Stream id reported for downlinks without a sequence header
+#define SEQ_NO_STREAM			(0xFF)
+
+enum SeqResult
+{
+	SEQ_NONE = 0,			//no sequence header, deliver as is
+	SEQ_DELIVER,			//deliver the message now in the buffer
+	SEQ_HELD,				//held for ordering, collect with pop()
+	SEQ_DUPLICATE,			//already delivered, drop
+	SEQ_DROPPED				//too long to hold behind an older message
+};
+
+class DownlinkSequencer {
+
+	public:
+
+		DownlinkSequencer();
+
+		void reset(void);
+
+		//Feed a received downlink.  On SEQ_DELIVER buf holds the payload to
+		//deliver without its header; it may be an older held message.
+		SeqResult push(uint8_t* buf, uint8_t* len, uint32_t now, uint8_t* stream);
+
+		//Next held message that is now in order, false if none
+		bool pop(uint8_t* buf, uint8_t* len, uint8_t* stream, uint32_t now);
+
+		//Skip gaps that have been open longer than timeout_ms
+		void poll(uint32_t now, uint32_t timeout_ms);
+
+		//When poll() will next skip a gap, false if no gap is open
+		bool gapDeadline(uint32_t timeout_ms, uint32_t* at);
+
+		uint32_t duplicates(void);
+
+	private:
+
+		typedef struct
+		{
+			uint16_t seq;
+			uint8_t len;
+			bool used;
+			uint8_t data[SEQ_MSG_LEN];
+		} heldMsg;
+
+		typedef struct
+		{
+			uint16_t next;			//next sequence number to deliver
+			uint32_t seen;			//bit i: next - 1 - i was delivered
+			uint32_t gapSince;
+			bool active;
+			heldMsg held[SEQ_HOLD_SLOTS];
+		} seqStream;
+
+		seqStream _streams[SEQ_MAX_STREAMS];
+		uint32_t _duplicates;
+
+		void delivered(seqStream* s, uint32_t now);
+		void skipTo(seqStream* s, uint16_t seq);
+		int8_t oldestHeld(seqStream* s);
+};
+
+#endif // SYMPHONYLINKSEQ_H
@@ -0,0 +1,176 @@
+#include "SymphonyLinkSession.h"
+#include <string.h>
+
+#define SESSION_MAGIC			(0x53)
+#define SESSION_CRC_LEN			(2)
+
+
+static void sessionPut32(uint8_t* p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)(v);
+}
+
+static uint32_t sessionGet32(const uint8_t* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+LoRaWANSession::LoRaWANSession(JournalStorage* storage)
+{
+	_storage = storage;
+	memset(&_state, 0, sizeof(_state));
+	_valid = false;
+	_seq = 0;
+	_slot = 1;
+	_savedAt = 0;
+}
+
+bool LoRaWANSession::begin(void)
+{
+	LoRaWANSessionState state;
+	uint32_t seq;
+	uint8_t i;
+
+	_valid = false;
+	_seq = 0;
+	_slot = 1;
+
+	if(_storage->size() < slotAddr(2))
+	{
+		return false;
+	}
+
+	for(i = 0; i < 2; i++)
+	{
+		if(readSlot(i, &state, &seq) && (!_valid || ((int32_t)(seq - _seq) > 0)))
+		{
+			_state = state;
+			_seq = seq;
+			_slot = i;
+			_valid = true;
+		}
+	}
+	return true;
+}
+
+bool LoRaWANSession::valid(void)
+{
+	return _valid;
+}
+
+const LoRaWANSessionState* LoRaWANSession::state(void)
+{
+	return _valid ? &_state : NULL;
+}
+
+bool LoRaWANSession::due(uint32_t uplinks, uint32_t now)
+{
+	if(!_valid)
+	{
+		return false;
+	}
+	return ((uplinks - _state.uplinks) >= SESSION_SAVE_UPLINKS) ||
+		   ((uplinks != _state.uplinks) && ((now - _savedAt) >= SESSION_SAVE_INTERVAL_MS));
+}
+
+bool LoRaWANSession::save(const LoRaWANSessionState* state, uint32_t now)
+{
+	uint8_t rec[SESSION_RECORD_LEN];
+	uint8_t slot = _slot ^ 1;
+	uint16_t crc;
+
+	rec[0] = SESSION_MAGIC;
+	sessionPut32(&rec[1], _seq + 1);
+	rec[5] = state->abp;
+	rec[6] = state->network;
+	rec[7] = state->device_class;
+	sessionPut32(&rec[8], state->net_id);
+	sessionPut32(&rec[12], state->dev_addr);
+	memcpy(&rec[16], state->dev_eui, 8);
+	memcpy(&rec[24], state->app_eui, 8);
+	sessionPut32(&rec[32], state->uplinks);
+	sessionPut32(&rec[36], state->downlinks);
+
+	crc = journalCrc(0, &rec[1], SESSION_RECORD_LEN - 1 - SESSION_CRC_LEN);
+	rec[40] = (uint8_t)(crc >> 8);
+	rec[41] = (uint8_t)(crc);
+
+	//Into the older copy, the newer one stays until this one is complete
+	if(((_storage->eraseSize() != 0) && !_storage->erase(slotAddr(slot))) ||
+	   !_storage->write(slotAddr(slot), rec, SESSION_RECORD_LEN) ||
+	   !_storage->flush())
+	{
+		return false;
+	}
+
+	_state = *state;
+	_seq++;
+	_slot = slot;
+	_valid = true;
+	_savedAt = now;
+	return true;
+}
+
+bool LoRaWANSession::clear(void)
+{
+	uint8_t rec[SESSION_RECORD_LEN];
+	uint8_t i;
+
+	memset(rec, 0, sizeof(rec));
+	for(i = 0; i < 2; i++)
+	{
+		if(((_storage->eraseSize() != 0) && !_storage->erase(slotAddr(i))) ||
+		   !_storage->write(slotAddr(i), rec, SESSION_RECORD_LEN))
+		{
+			return false;
+		}
+	}
+
+	_valid = false;
+	return _storage->flush();
+}
+
+uint32_t LoRaWANSession::slotAddr(uint8_t slot)
+{
+	uint32_t eraseSize = _storage->eraseSize();
+	uint32_t stride = SESSION_RECORD_LEN;
+
+	if(eraseSize != 0)
+	{
+		stride = ((stride + eraseSize - 1) / eraseSize) * eraseSize;
+	}
+	return slot * stride;
+}
+
+bool LoRaWANSession::readSlot(uint8_t slot, LoRaWANSessionState* state, uint32_t* seq)
+{
+	uint8_t rec[SESSION_RECORD_LEN];
+	uint16_t crc;
+
+	if(!_storage->read(slotAddr(slot), rec, SESSION_RECORD_LEN) || (rec[0] != SESSION_MAGIC))
+	{
+		return false;
+	}
+
+	crc = journalCrc(0, &rec[1], SESSION_RECORD_LEN - 1 - SESSION_CRC_LEN);
+	if(crc != (((uint16_t)rec[40] << 8) | rec[41]))
+	{
+		return false;
+	}
+
+	*seq = sessionGet32(&rec[1]);
+	state->abp = rec[5];
+	state->network = rec[6];
+	state->device_class = rec[7];
+	state->net_id = sessionGet32(&rec[8]);
+	state->dev_addr = sessionGet32(&rec[12]);
+	memcpy(state->dev_eui, &rec[16], 8);
+	memcpy(state->app_eui, &rec[24], 8);
+	state->uplinks = sessionGet32(&rec[32]);
+	state->downlinks = sessionGet32(&rec[36]);
+	return true;
+}
@@ -0,0 +1,69 @@
+
+#ifndef SYMPHONYLINKSESSION_H
+#define SYMPHONYLINKSESSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "SymphonyLinkJournal.h"
+
+//Stored snapshot size, two of them are kept
+#define SESSION_RECORD_LEN			(42)
+
+//Counter snapshots are coalesced: written once the uplink counter has moved
+//SESSION_SAVE_UPLINKS past the stored one, or after SESSION_SAVE_INTERVAL_MS
+//with any change.  A new session is written straight away.
+#define SESSION_SAVE_UPLINKS		(32)
+#define SESSION_SAVE_INTERVAL_MS	(3600000)
+
+//Identifies a LoRaWAN session and how far its counters had got
+typedef struct
+{
+	uint8_t abp;
+	uint8_t network;			//ll_lorawan_network_type_e
+	uint8_t device_class;		//ll_lorawan_device_class_e
+	uint32_t net_id;			//ABP only
+	uint32_t dev_addr;			//ABP only
+	uint8_t dev_eui[8];			//OTAA only
+	uint8_t app_eui[8];			//OTAA only
+	uint32_t uplinks;
+	uint32_t downlinks;
+} LoRaWANSessionState;
+
+/*
+ * Non-volatile snapshot of a LoRaWAN session.
+ *
+ * Two copies are written alternately behind a sequence number and a CRC, so
+ * a power loss during a write leaves the previous one intact; begin() loads
+ * whichever intact copy is newer.  Storage with an erase granularity gets
+ * each copy in its own erase block.  Keys aren't stored: the module keeps
+ * them, and an ABP application passes them in on every start anyway.
+ */
+class LoRaWANSession {
+
+	public:
+
+		LoRaWANSession(JournalStorage* storage);
+
+		bool begin(void);
+		bool valid(void);
+		const LoRaWANSessionState* state(void);
+
+		//Write a snapshot now, or only when due() says so
+		bool save(const LoRaWANSessionState* state, uint32_t now);
+		bool due(uint32_t uplinks, uint32_t now);
+		bool clear(void);
+
+	private:
+
+		JournalStorage* _storage;
+		LoRaWANSessionState _state;
+		bool _valid;
+		uint32_t _seq;				//of the stored snapshot
+		uint8_t _slot;				//holding it
+		uint32_t _savedAt;
+
+		uint32_t slotAddr(uint8_t slot);
+		bool readSlot(uint8_t slot, LoRaWANSessionState* state, uint32_t* seq);
+};
+
+#endif // SYMPHONYLINKSESSION_H
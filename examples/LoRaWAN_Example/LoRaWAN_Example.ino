@@ -0,0 +1,113 @@
+#include <SymphonyLinkLoRaWAN.h>
+
+#define SL_RESET_PIN 7
+#define SL_BOOT_PIN 8
+#define SL_IRQ_PIN 13
+
+
+LoRaWANLink lorawan;
+MulticastGroups groups;
+
+//configure these to match your LoRaWAN network server
+uint8_t devEui[8] = {0,0,0,0,0,0,0,0};		//all zero uses the module's own EUI
+uint8_t appEui[8] = {0x70,0xb3,0xd5,0x7e,0xd0,0x00,0x00,0x00};
+uint8_t appKey[16] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+
+//Downlinks on fPort 10 switch the LED
+void onCommand(uint8_t port, const uint8_t* buf, uint8_t len, const ll_lorawan_rx_t* rx)
+{
+	digitalWrite(LED_BUILTIN, buf[0] ? HIGH : LOW);
+}
+
+//Multicast to group 1 switches the LED of every device in it
+void onGroupCommand(uint8_t group, const uint8_t* buf, uint16_t len, const ll_lorawan_rx_t* rx)
+{
+	if (len > 0)
+	{
+		digitalWrite(LED_BUILTIN, buf[0] ? HIGH : LOW);
+	}
+}
+
+void onSent(uint8_t port, const uint8_t* buf, uint8_t len, boolean success)
+{
+	Serial.write(success ? "Uplink sent\n" : "Uplink failed\n");
+}
+
+void setup() 
+{
+	pinMode(SL_RESET_PIN, OUTPUT);
+	pinMode(SL_BOOT_PIN, OUTPUT);
+	pinMode(SL_IRQ_PIN, INPUT);
+	pinMode(LED_BUILTIN, OUTPUT);
+
+	digitalWrite(SL_BOOT_PIN, LOW);
+	digitalWrite(SL_RESET_PIN, LOW);
+
+	Serial1.begin(115200);
+	Serial.begin(115200);
+
+	//reset the module and wait until it has finished booting
+	digitalWrite(SL_RESET_PIN, HIGH);
+	delay(10);
+	digitalWrite(SL_RESET_PIN, LOW);
+
+	Serial.write("Starting system\n");
+
+	moduleWaitForReady();
+
+	lorawan.onReceive(10, onCommand);
+	lorawan.setTxCallback(onSent);
+
+	groups.join(1, NULL, 0);
+	lorawan.attachMulticast(&groups);
+	lorawan.onMulticast(onGroupCommand);
+
+	//Link checks as often as the link's health calls for, and acknowledged
+	//uplinks while it is marginal
+	lorawan.setAdaptiveLinkCheck(true);
+	lorawan.setAdaptiveConfirm(true);
+
+	//Readings on fPort 2 share frames when more than one is waiting
+	lorawan.setRegion(REGION_US915);
+	lorawan.setBatching(2, true);
+
+	//Starts the join, it completes in loop()
+	lorawan.begin(devEui, appEui, appKey);
+}
+
+
+uint8_t data[2] = {0,0};
+uint32_t lastSend = 0;
+uint32_t lastSample = 0;
+uint32_t lastJoinTry = 0;
+
+void loop()
+{
+	//Out of join attempts: rest for an hour, then start over with a fresh set
+	if (lorawan.update() != LORAWAN_JOIN_FAILED)
+	{
+		lastJoinTry = millis();
+	}
+	else if ((millis() - lastJoinTry) >= 3600000)
+	{
+		lorawan.rejoin();
+	}
+
+	//Queue a counter every minute, confirmed every tenth time
+	if (lorawan.isJoined() && ((millis() - lastSend) >= 60000))
+	{
+		lastSend = millis();
+		data[0]++;
+		lorawan.write(1, data, 2, (data[0] % 10) == 0);
+	}
+
+	//Sample the LED every ten seconds, bulk traffic waits for ADR to settle
+	if (lorawan.isJoined() && ((millis() - lastSample) >= 10000))
+	{
+		lastSample = millis();
+		data[1] = digitalRead(LED_BUILTIN);
+		lorawan.write(2, &data[1], 1, false, PRIORITY_BULK);
+	}
+
+	delay(lorawan.pollTimeout());
+}
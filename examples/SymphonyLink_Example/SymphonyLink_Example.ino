@@ -37,14 +37,15 @@ void setup()
 	Serial.begin(115200);
 
 
-	//reset the module and wait 2 seconds for boot.
+	//reset the module and wait until it has finished booting.
 	digitalWrite(SL_RESET_PIN, HIGH);
 	delay(10);
 	digitalWrite(SL_RESET_PIN, LOW);
-	delay(2000);
 
 	Serial.write("Starting system\n");
 	
+	symlink.waitForReady();
+	
 	symlink.setAntenna(UFL);
 
 	//send configuration data to initial the device
@@ -0,0 +1,91 @@
+#include <SymphonyLink.h>
+
+//Compresses typical text and JSON uplinks and reports the compression ratio
+//and the encoder/decoder cost in CPU cycles per input byte.  No module needed.
+
+#define ROUNDS 20
+
+const char* samples[] =
+{
+	"{\"status\":\"ok\",\"id\":17,\"config\":{\"interval\":600,\"version\":\"1.2.3\"}}",
+	"{\"error\":\"failed\",\"code\":42,\"status\":\"retry\"}",
+	"WARN sensor timeout after 3 retry, reset pending",
+	"ERROR battery voltage low 3.21V temperature 41C",
+	"INFO connected rssi=-97 snr=4 gateway=0x1a2b3c"
+};
+
+uint8_t packed[SL_MAX_TX_LEN];
+uint8_t unpacked[SL_MAX_TX_LEN];
+
+void setup()
+{
+	uint32_t inBytes = 0;
+	uint32_t outBytes = 0;
+	uint32_t decodedBytes = 0;
+	uint32_t encodeUs = 0;
+	uint32_t decodeUs = 0;
+	uint32_t start;
+	uint16_t len;
+	uint16_t n;
+	int32_t m;
+	uint8_t i;
+	uint8_t r;
+
+	Serial.begin(115200);
+
+	for(i = 0; i < sizeof(samples) / sizeof(samples[0]); i++)
+	{
+		len = strlen(samples[i]);
+		if(len > sizeof(packed))
+		{
+			continue;
+		}
+
+		start = micros();
+		for(r = 0; r < ROUNDS; r++)
+		{
+			n = lzCompress((const uint8_t*)samples[i], len, packed, sizeof(packed));
+		}
+		encodeUs += micros() - start;
+
+		if(n == 0)
+		{
+			//Doesn't compress, would go out as is
+			inBytes += len;
+			outBytes += len;
+			continue;
+		}
+
+		start = micros();
+		for(r = 0; r < ROUNDS; r++)
+		{
+			m = lzDecompress(packed, n, unpacked, sizeof(unpacked));
+		}
+		decodeUs += micros() - start;
+		decodedBytes += len;
+
+		if((m != len) || (memcmp(unpacked, samples[i], len) != 0))
+		{
+			Serial.print("Round trip failed: ");
+			Serial.println(samples[i]);
+		}
+
+		Serial.print(len);
+		Serial.print(" -> ");
+		Serial.println(n);
+
+		inBytes += len;
+		outBytes += n;
+	}
+
+	Serial.print("Ratio: ");
+	Serial.println((float)inBytes / outBytes);
+	Serial.print("Encode cycles/byte: ");
+	Serial.println((float)encodeUs * (F_CPU / 1000000UL) / ((uint32_t)ROUNDS * inBytes));
+	Serial.print("Decode cycles/byte: ");
+	Serial.println((float)decodeUs * (F_CPU / 1000000UL) / ((uint32_t)ROUNDS * decodedBytes));
+}
+
+void loop()
+{
+}
@@ -0,0 +1,167 @@
+#include "arduino.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+HostSerial Serial(STDERR_FILENO);
+HostSerial Serial1(-1);
+
+HostSerial::HostSerial(int fd)
+{
+	_fd = fd;
+}
+
+void HostSerial::begin(unsigned long baud)
+{
+	(void)baud;
+}
+
+void HostSerial::setTimeout(unsigned long timeout_ms)
+{
+	(void)timeout_ms;
+}
+
+size_t HostSerial::write(uint8_t c)
+{
+	return write(&c, 1);
+}
+
+size_t HostSerial::write(const char* s)
+{
+	return write((const uint8_t*)s, strlen(s));
+}
+
+size_t HostSerial::write(const uint8_t* buf, size_t len)
+{
+	ssize_t ret;
+
+	if(_fd < 0)
+	{
+		return 0;
+	}
+	ret = ::write(_fd, buf, len);
+	return (ret < 0) ? 0 : (size_t)ret;
+}
+
+size_t HostSerial::print(const char* s)
+{
+	return write(s);
+}
+
+size_t HostSerial::print(char c)
+{
+	return write((uint8_t)c);
+}
+
+size_t HostSerial::print(long n, int base)
+{
+	if(n < 0)
+	{
+		return print('-') + print((unsigned long)-n, base);
+	}
+	return print((unsigned long)n, base);
+}
+
+size_t HostSerial::print(unsigned long n, int base)
+{
+	char s[24];
+
+	snprintf(s, sizeof(s), (base == HEX) ? "%lX" : "%lu", n);
+	return write(s);
+}
+
+size_t HostSerial::print(int n, int base)
+{
+	return print((long)n, base);
+}
+
+size_t HostSerial::print(unsigned int n, int base)
+{
+	return print((unsigned long)n, base);
+}
+
+size_t HostSerial::println(void)
+{
+	return write("\r\n");
+}
+
+int HostSerial::available(void)
+{
+	return 0;
+}
+
+int HostSerial::read(void)
+{
+	return -1;
+}
+
+size_t HostSerial::readBytes(uint8_t* buf, size_t len)
+{
+	(void)buf;
+	(void)len;
+	return 0;
+}
+
+
+
+static uint64_t monotonicUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+uint32_t millis(void)
+{
+	return (uint32_t)(monotonicUs() / 1000);
+}
+
+uint32_t micros(void)
+{
+	return (uint32_t)monotonicUs();
+}
+
+void delay(unsigned long ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	while(nanosleep(&ts, &ts) < 0)
+	{
+	}
+}
+
+long random(long max)
+{
+	return (max <= 0) ? 0 : (::random() % max);
+}
+
+long random(long min, long max)
+{
+	return (max <= min) ? min : (min + random(max - min));
+}
+
+void randomSeed(unsigned long seed)
+{
+	srandom(seed);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	(void)pin;
+	(void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+	(void)pin;
+	(void)value;
+}
+
+int digitalRead(uint8_t pin)
+{
+	(void)pin;
+	return LOW;
+}
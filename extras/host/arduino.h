@@ -0,0 +1,83 @@
+
+#ifndef ARDUINO_HOST_H
+#define ARDUINO_HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+/*
+ * The few Arduino core calls the library makes, for building it on a Linux
+ * host such as a gateway:
+ *
+ *   gcc -c -I . *.c
+ *   g++ -std=c++20 -c -I extras/host -I . *.cpp extras/host/arduino.cpp
+ *
+ * Serial writes to stderr.  Serial1 has no device behind it, so every link
+ * on a host needs its own UART from openTransport().  Pins aren't wired up:
+ * digitalRead() reads LOW, so leave a link's IRQ pin unset and use
+ * attachIrq() instead.
+ */
+
+#define HIGH		(1)
+#define LOW			(0)
+#define INPUT		(0)
+#define OUTPUT		(1)
+#define DEC			(10)
+#define HEX			(16)
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+class HostSerial {
+
+	public:
+
+		HostSerial(int fd);
+
+		void begin(unsigned long baud);
+		void setTimeout(unsigned long timeout_ms);
+
+		size_t write(uint8_t c);
+		size_t write(const char* s);
+		size_t write(const uint8_t* buf, size_t len);
+
+		size_t print(const char* s);
+		size_t print(char c);
+		size_t print(long n, int base = DEC);
+		size_t print(unsigned long n, int base = DEC);
+		size_t print(int n, int base = DEC);
+		size_t print(unsigned int n, int base = DEC);
+		size_t println(void);
+		template<class T> size_t println(T v) { return print(v) + println(); }
+
+		int available(void);
+		int read(void);
+		size_t readBytes(uint8_t* buf, size_t len);
+
+	private:
+
+		int _fd;			//-1: nothing attached
+};
+
+extern HostSerial Serial;
+extern HostSerial Serial1;
+
+//32 bits wide as on the boards, so the library's wraparound arithmetic holds
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(unsigned long ms);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+template<class T> const T& min(const T& a, const T& b) { return (b < a) ? b : a; }
+template<class T> const T& max(const T& a, const T& b) { return (a < b) ? b : a; }
+
+#endif // ARDUINO_HOST_H
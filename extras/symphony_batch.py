@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+"""Cloud side of LoRaWANLink uplink batching.
+
+Mirrors LW_BATCH_RECORD_HEADER in SymphonyLinkLoRaWAN.h.  An uplink on a port
+the device set up with setBatching() carries one or more records, each a
+length byte followed by that many bytes of one write().  decode() returns the
+payloads in the order they were packed; encode() builds the same frames as
+the device, for tests.
+
+Run this file directly for a round trip self-test.
+"""
+
+
+def decode(frame):
+    records = []
+    p = 0
+    while p < len(frame):
+        n = frame[p]
+        if n == 0 or p + 1 + n > len(frame):
+            raise ValueError("bad record at offset %d" % p)
+        records.append(bytes(frame[p + 1:p + 1 + n]))
+        p += 1 + n
+    return records
+
+
+def encode(payloads):
+    out = bytearray()
+    for payload in payloads:
+        if not 0 < len(payload) < 256:
+            raise ValueError("record length out of range")
+        out.append(len(payload))
+        out += payload
+    return bytes(out)
+
+
+if __name__ == "__main__":
+    samples = [
+        [b'\x01\x02'],
+        [b'\x17' * 9, b'\x18' * 20, b'\x19'],
+    ]
+    for s in samples:
+        frame = encode(s)
+        assert decode(frame) == s, s
+        print("%d records -> %3d" % (len(s), len(frame)))
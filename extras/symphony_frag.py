@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+"""Cloud side of the SymphonyLink fragmentation protocol.
+
+Mirrors SymphonyLinkFrag.h: FragmentReceiver reassembles uplink transfers from
+the module and produces the acks to send back as downlinks, FragmentSender
+splits a large downlink into fragments and re-sends what the module reports
+missing.  Frames are plain bytes; plug them into whatever uplink/downlink API
+the network server provides.
+
+Run this file directly for a loopback self-test over a lossy link.
+"""
+
+FRAG_MARKER = 0xF0
+FRAG_MARKER_MASK = 0xF0
+FRAG_DATA = 0x01
+FRAG_ACK = 0x02
+FRAG_DATA_ACK_REQ = 0x03
+
+FRAG_HEADER_LEN = 5
+FRAG_ACK_HEADER_LEN = 3
+FRAG_MAX_FRAGMENTS = 255
+FRAG_MAX_ROUNDS = 5
+
+
+def is_fragment(frame):
+    return len(frame) >= FRAG_HEADER_LEN and \
+        (frame[0] & FRAG_MARKER_MASK) == FRAG_MARKER and \
+        (frame[0] & ~FRAG_MARKER_MASK) in (FRAG_DATA, FRAG_DATA_ACK_REQ)
+
+
+def is_ack(frame):
+    return len(frame) >= FRAG_ACK_HEADER_LEN and frame[0] == FRAG_MARKER | FRAG_ACK
+
+
+class FragmentReceiver(object):
+    """Reassembles one transfer at a time per device."""
+
+    def __init__(self, timeout_s=120.0):
+        self.timeout_s = timeout_s
+        self._id = None
+        self._count = 0
+        self._frag_size = 0
+        self._frags = {}
+        self._last_rx = 0.0
+        self._done_id = None
+        self._done_count = 0
+
+    def push(self, frame, now):
+        """Feed one uplink.
+
+        Returns (payload, ack): payload is the reassembled bytes once the
+        transfer completes, ack the frame to send back as a downlink.  Either
+        may be None.
+        """
+        if not is_fragment(frame):
+            return None, None
+
+        ftype = frame[0] & ~FRAG_MARKER_MASK
+        fid, idx, count, frag_size = frame[1], frame[2], frame[3], frame[4]
+        chunk = bytes(frame[FRAG_HEADER_LEN:])
+        if count == 0 or idx >= count or frag_size == 0 or len(chunk) > frag_size or \
+                (idx + 1 < count and len(chunk) != frag_size):
+            return None, None
+
+        # A retransmission of the transfer just delivered only needs a fresh ack
+        if self._id is None and fid == self._done_id and count == self._done_count:
+            return None, self._ack(fid, count, set(range(count)))
+
+        if self._id is not None and now - self._last_rx >= self.timeout_s:
+            self._id = None
+
+        if self._id != fid or self._count != count or self._frag_size != frag_size:
+            self._id, self._count, self._frag_size = fid, count, frag_size
+            self._frags = {}
+
+        self._last_rx = now
+        self._frags.setdefault(idx, chunk)
+
+        if len(self._frags) == count:
+            payload = b"".join(self._frags[i] for i in range(count))
+            self._done_id, self._done_count = fid, count
+            self._id = None
+            return payload, self._ack(fid, count, set(range(count)))
+
+        if ftype == FRAG_DATA_ACK_REQ:
+            return None, self._ack(fid, count, set(self._frags))
+        return None, None
+
+    @staticmethod
+    def _ack(fid, count, held):
+        bitmap = bytearray((count + 7) // 8)
+        for i in held:
+            bitmap[i >> 3] |= 1 << (i & 7)
+        return bytes([FRAG_MARKER | FRAG_ACK, fid, count]) + bytes(bitmap)
+
+
+class FragmentSender(object):
+    """Splits a payload into fragments and tracks which the device holds."""
+
+    def __init__(self, frag_size, ack_timeout_s=30.0):
+        if not 0 < frag_size <= 255:
+            raise ValueError("frag_size must be 1..255")
+        self.frag_size = frag_size
+        self.ack_timeout_s = ack_timeout_s
+        self._id = 0
+        self._active = False
+
+    def start(self, payload, reliable=True):
+        if self._active:
+            raise RuntimeError("transfer in progress")
+        count = (len(payload) + self.frag_size - 1) // self.frag_size
+        if count == 0 or count > FRAG_MAX_FRAGMENTS:
+            raise ValueError("payload doesn't fit in %d fragments" % FRAG_MAX_FRAGMENTS)
+        self._payload = bytes(payload)
+        self._count = count
+        self._id = (self._id + 1) & 0xFF
+        self._pending = set(range(count))
+        self._reliable = reliable
+        self._rounds = 0
+        self._sent_at = None
+        self._active = True
+
+    @property
+    def busy(self):
+        return self._active
+
+    def round(self, now):
+        """Fragments to send for the current round, empty while waiting for an ack."""
+        if not self._active or self._sent_at is not None:
+            return []
+        frames = []
+        pending = sorted(self._pending)
+        for n, idx in enumerate(pending):
+            last = n + 1 == len(pending)
+            ftype = FRAG_DATA_ACK_REQ if (last and self._reliable) else FRAG_DATA
+            chunk = self._payload[idx * self.frag_size:(idx + 1) * self.frag_size]
+            frames.append(bytes([FRAG_MARKER | ftype, self._id, idx, self._count,
+                                 self.frag_size]) + chunk)
+        if self._reliable:
+            self._sent_at = now
+        else:
+            self._active = False
+        return frames
+
+    def handle_ack(self, frame):
+        """Returns True once the device holds every fragment."""
+        if not self._active or not is_ack(frame) or frame[1] != self._id or \
+                frame[2] != self._count or \
+                len(frame) < FRAG_ACK_HEADER_LEN + (self._count + 7) // 8:
+            return False
+        bitmap = frame[FRAG_ACK_HEADER_LEN:]
+        self._pending = set(i for i in self._pending
+                            if not bitmap[i >> 3] & (1 << (i & 7)))
+        if not self._pending:
+            self._active = False
+            return True
+        self._rounds = 0
+        self._sent_at = None
+        return False
+
+    def poll(self, now):
+        """Re-arm the round after an ack timeout.  Returns False once abandoned."""
+        if self._active and self._sent_at is not None and \
+                now - self._sent_at >= self.ack_timeout_s:
+            self._rounds += 1
+            if self._rounds >= FRAG_MAX_ROUNDS:
+                self._active = False
+                return False
+            self._sent_at = None
+        return True
+
+
+if __name__ == "__main__":
+    import random
+
+    rng = random.Random(1)
+    payload = bytes(rng.randrange(256) for _ in range(3000))
+    tx = FragmentSender(frag_size=51)
+    rx = FragmentReceiver()
+    tx.start(payload)
+
+    now = 0.0
+    received = None
+    sent = dropped = 0
+    while tx.busy:
+        now += 1.0
+        tx.poll(now)
+        for frame in tx.round(now):
+            sent += 1
+            if rng.randrange(7) == 0:
+                dropped += 1
+                continue
+            data, ack = rx.push(frame, now)
+            if data is not None:
+                received = data
+            if ack is not None and rng.randrange(7) != 0:
+                tx.handle_ack(ack)
+        now += tx.ack_timeout_s
+
+    assert received == payload, "reassembly mismatch"
+    print("sent=%d dropped=%d len=%d ok" % (sent, dropped, len(received)))
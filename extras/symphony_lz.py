@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Cloud side of the SymphonyLink LZSS payload compression.
+
+Mirrors SymphonyLinkLz.h.  decode() turns an uplink back into the payload the
+application wrote; payloads that aren't marked as compressed are returned as
+they are.  encode() produces the same frames as the device, for tests.
+
+Run this file directly for a round trip self-test.
+"""
+
+LZ_MARKER = 0xD0
+LZ_MARKER_MASK = 0xF0
+LZ_FLAG_DICT = 0x01
+
+LZ_WINDOW = 1024
+LZ_MIN_MATCH = 3
+LZ_MAX_MATCH = LZ_MIN_MATCH + 63
+
+# Must match lzDict in SymphonyLinkLz.cpp byte for byte
+LZ_DICT = (b'DEBUG WARN INFO ERROR failed timeout retry reset connected disconnected '
+           b'sensor battery voltage temperature humidity pressure interval version '
+           b'config":{"id":"value":"time":"type":"name":"code":'
+           b'null,false,true,"error":"status":"ok"}')
+
+
+def is_compressed(frame):
+    return len(frame) > 1 and (frame[0] & LZ_MARKER_MASK) == LZ_MARKER
+
+
+def decode(frame):
+    if not is_compressed(frame):
+        return bytes(frame)
+    if not frame[0] & LZ_FLAG_DICT:
+        return bytes(frame[1:])
+
+    out = bytearray(LZ_DICT)
+    p = 1
+    item = 8
+    flags = 0
+    while p < len(frame):
+        if item == 8:
+            flags = frame[p]
+            p += 1
+            item = 0
+            continue
+        match = flags & (1 << item)
+        item += 1
+        if not match:
+            out.append(frame[p])
+            p += 1
+            continue
+        if p + 2 > len(frame):
+            raise ValueError("truncated match")
+        dist = (((frame[p] >> 6) << 8) | frame[p + 1]) + 1
+        n = (frame[p] & 0x3F) + LZ_MIN_MATCH
+        p += 2
+        src = len(out) - dist
+        if src < 0:
+            raise ValueError("distance out of range")
+        for i in range(n):
+            out.append(out[src + i])
+    return bytes(out[len(LZ_DICT):])
+
+
+def encode(payload):
+    """Frame as SymphonyLink::write sends it with compression enabled."""
+    data = LZ_DICT + bytes(payload)
+    base = len(LZ_DICT)
+    out = bytearray([LZ_MARKER | LZ_FLAG_DICT])
+    i = base
+    flag_pos = None
+    item = 8
+    while i < len(data):
+        if item == 8:
+            flag_pos = len(out)
+            out.append(0)
+            item = 0
+        limit = min(LZ_MAX_MATCH, len(data) - i)
+        best = best_dist = 0
+        for j in range(i - 1, max(0, i - LZ_WINDOW) - 1, -1):
+            k = 0
+            while k < limit and data[j + k] == data[i + k]:
+                k += 1
+            if k > best:
+                best, best_dist = k, i - j
+                if best == limit:
+                    break
+        if best >= LZ_MIN_MATCH:
+            out[flag_pos] |= 1 << item
+            out.append((((best_dist - 1) >> 8) << 6) | (best - LZ_MIN_MATCH))
+            out.append((best_dist - 1) & 0xFF)
+            i += best
+        else:
+            out.append(data[i])
+            i += 1
+        item += 1
+
+    if len(out) < len(payload):
+        return bytes(out)
+    if is_compressed(payload):
+        return bytes([LZ_MARKER]) + bytes(payload)
+    return bytes(payload)
+
+
+if __name__ == "__main__":
+    samples = [
+        b'{"status":"ok","id":17,"config":{"interval":600,"version":"1.2.3"}}',
+        b'WARN sensor timeout after 3 retry, reset pending',
+        b'\xd5\x01',
+        b'ok',
+    ]
+    for s in samples:
+        frame = encode(s)
+        assert decode(frame) == s, s
+        print("%3d -> %3d" % (len(s), len(frame)))
@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""Cloud side of LoRaWAN multicast groups.
+
+Mirrors SymphonyLinkMulticast.h.  GroupSender builds the frames for one group:
+message() for a single downlink, transfer() for a payload split into
+fragments (symphony_frag.py layout) and sent as a number of rounds, since no
+device acknowledges a multicast.  A device that still misses fragments
+afterwards uplinks a status frame; repair() turns it into the fragments to
+send that device unicast.  Every frame takes the group's next sequence
+number, repairs included, so a device drops whatever it hears twice.
+
+Group frames go out on MCAST_PORT and repairs on MCAST_REPAIR_PORT, where
+devices also uplink their status (LW_MCAST_PORT and LW_MCAST_REPAIR_PORT on
+the device).  A device takes a sequence number up to MCAST_RESTART_DISTANCE
+behind the last one it heard as old, so keep a sender's count across
+restarts (the seq argument), or move it further ahead than that.
+
+Run this file directly for a self-test over a lossy fleet.
+"""
+
+from symphony_frag import FRAG_MARKER, FRAG_DATA, FRAG_ACK, \
+    FRAG_ACK_HEADER_LEN, FRAG_MAX_FRAGMENTS
+
+MCAST_MARKER = 0xC0
+MCAST_MARKER_MASK = 0xF0
+MCAST_DATA = 0x01
+MCAST_FRAG = 0x02
+MCAST_STATUS = 0x03
+MCAST_HEADER_LEN = 4
+MCAST_RESTART_DISTANCE = 1024
+MCAST_PORT = 200
+MCAST_REPAIR_PORT = 201
+
+
+def decode_status(frame):
+    """Returns (group, last_seq, transfer_id, count, held) or None."""
+    if len(frame) < MCAST_HEADER_LEN + FRAG_ACK_HEADER_LEN or \
+            frame[0] != MCAST_MARKER | MCAST_STATUS or \
+            frame[MCAST_HEADER_LEN] != FRAG_MARKER | FRAG_ACK:
+        return None
+    group = frame[1]
+    last_seq = (frame[2] << 8) | frame[3]
+    fid, count = frame[MCAST_HEADER_LEN + 1], frame[MCAST_HEADER_LEN + 2]
+    bitmap = frame[MCAST_HEADER_LEN + FRAG_ACK_HEADER_LEN:]
+    if len(bitmap) < (count + 7) // 8:
+        return None
+    held = set(i for i in range(count) if bitmap[i >> 3] & (1 << (i & 7)))
+    return group, last_seq, fid, count, held
+
+
+class GroupSender(object):
+    """Frames for one multicast group."""
+
+    def __init__(self, group, frag_size, seq=0):
+        if not 0 <= group <= 255:
+            raise ValueError("group must be 0..255")
+        if not 0 < frag_size <= 255:
+            raise ValueError("frag_size must be 1..255")
+        self.group = group
+        self.frag_size = frag_size
+        self._seq = seq & 0xFFFF
+        self._id = 0
+        self._payload = None
+        self._count = 0
+
+    def _header(self, ftype):
+        header = bytes([MCAST_MARKER | ftype, self.group, self._seq >> 8, self._seq & 0xFF])
+        self._seq = (self._seq + 1) & 0xFFFF
+        return header
+
+    def _fragment(self, idx):
+        chunk = self._payload[idx * self.frag_size:(idx + 1) * self.frag_size]
+        return self._header(MCAST_FRAG) + bytes([FRAG_MARKER | FRAG_DATA, self._id, idx,
+                                                 self._count, self.frag_size]) + chunk
+
+    def message(self, payload):
+        return self._header(MCAST_DATA) + bytes(payload)
+
+    def transfer(self, payload, rounds=3):
+        """Frames for every round of a new transfer, in order."""
+        count = (len(payload) + self.frag_size - 1) // self.frag_size
+        if count == 0 or count > FRAG_MAX_FRAGMENTS:
+            raise ValueError("payload doesn't fit in %d fragments" % FRAG_MAX_FRAGMENTS)
+        self._payload = bytes(payload)
+        self._count = count
+        self._id = (self._id + 1) & 0xFF
+        return [self._fragment(i) for _ in range(rounds) for i in range(count)]
+
+    def repair(self, status):
+        """Fragments of the current transfer a device reports missing."""
+        decoded = decode_status(status)
+        if decoded is None or self._payload is None:
+            return []
+        group, _, fid, count, held = decoded
+        if group != self.group:
+            return []
+        # A device that hasn't heard this transfer at all reports an older one
+        if fid != self._id or count != self._count:
+            held = set()
+        return [self._fragment(i) for i in range(self._count) if i not in held]
+
+
+if __name__ == "__main__":
+    import random
+
+    class Device(object):
+        """What MulticastGroups keeps for one joined group, for the test."""
+
+        def __init__(self, group):
+            self.group = group
+            self.seen = set()
+            self.last = None
+            self.frags = {}
+            self.fid = None
+            self.count = 0
+            self.done = None
+            self.duplicates = 0
+
+        def push(self, frame):
+            if frame[1] != self.group:
+                return
+            seq = (frame[2] << 8) | frame[3]
+            if seq in self.seen:
+                self.duplicates += 1
+                return
+            self.seen.add(seq)
+            self.last = seq
+            frag = frame[MCAST_HEADER_LEN:]
+            if frag[1] != self.fid:
+                self.fid, self.count, self.frags = frag[1], frag[3], {}
+            self.frags.setdefault(frag[2], bytes(frag[5:]))
+            if self.done is None and len(self.frags) == self.count:
+                self.done = b"".join(self.frags[i] for i in range(self.count))
+
+        def status(self):
+            bitmap = bytearray((self.count + 7) // 8)
+            for i in self.frags:
+                bitmap[i >> 3] |= 1 << (i & 7)
+            return bytes([MCAST_MARKER | MCAST_STATUS, self.group, self.last >> 8,
+                          self.last & 0xFF, FRAG_MARKER | FRAG_ACK, self.fid,
+                          self.count]) + bytes(bitmap)
+
+    rng = random.Random(1)
+    payload = bytes(rng.randrange(256) for _ in range(4000))
+    tx = GroupSender(group=7, frag_size=200)
+    fleet = [Device(7) for _ in range(1000)]
+
+    frames = tx.transfer(payload, rounds=2)
+    for frame in frames:
+        for dev in fleet:
+            if rng.randrange(5) == 0:
+                continue
+            dev.push(frame)
+            if rng.randrange(20) == 0:
+                dev.push(frame)     # heard through a second gateway
+
+    missing = [dev for dev in fleet if dev.done is None]
+    repairs = 0
+    for dev in missing:
+        for frame in tx.repair(dev.status()):
+            repairs += 1
+            dev.push(frame)
+
+    assert all(dev.done == payload for dev in fleet), "reassembly mismatch"
+    print("multicast=%d devices=%d repaired=%d unicast=%d duplicates=%d ok" %
+          (len(frames), len(fleet), len(missing), repairs,
+           sum(dev.duplicates for dev in fleet)))
@@ -3,6 +3,7 @@
 #include "ifc_struct_defs.h"
 #include "ll_ifc_symphony.h"
 #include "ll_ifc_no_mac.h"
+#include "ll_ifc_private.h"
 #include "time.h"
 #include <stdio.h>
 #include <string.h>
@@ -12,9 +13,9 @@
 #endif
 #define CMD_HEADER_LEN      (5)
 #define RESP_HEADER_LEN     (6)
-static uint16_t compute_checksum(uint8_t *hdr, uint16_t hdr_len, uint8_t *payload, uint16_t payload_len);
-static void send_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint16_t len);
-static int32_t recv_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint16_t len);
+static uint16_t checksum_update(uint16_t crc, uint8_t const *data, uint16_t len);
+static void send_packet(opcode_t op, uint8_t message_num, uint8_t const *hdr, uint16_t hdr_len, uint8_t const *buf, uint16_t len);
+static int32_t recv_packet(opcode_t op, uint8_t message_num, uint8_t *hdr, uint16_t hdr_len, uint8_t *buf, uint16_t len);
 
 const uint32_t OPEN_NET_TOKEN = 0x4f50454e;
 
@@ -22,35 +23,91 @@ static int32_t message_num = 0;
 
 int32_t hal_read_write(opcode_t op, uint8_t buf_in[], uint16_t in_len, uint8_t buf_out[], uint16_t out_len)
 {
-    //  int i;
-    //  int curr_byte;
-    //  int num_bytes;
+    return hal_read_write_sg(op, NULL, 0, buf_in, in_len, NULL, 0, buf_out, out_len);
+}
 
+int32_t hal_read_write_sg(opcode_t op,
+                          uint8_t const hdr_in[], uint16_t hdr_in_len, uint8_t const buf_in[], uint16_t in_len,
+                          uint8_t hdr_out[], uint16_t hdr_out_len, uint8_t buf_out[], uint16_t out_len)
+{
     int32_t ret;
 
     // Error checking:
-    // Only valid combinations of bufher & length pairs are:
+    // Only valid combinations of buffer & length pairs are:
     // buf == NULL, len = 0
     // buf != NULL, len > 0
+    if (((hdr_in != NULL) && (hdr_in_len == 0)) || ((hdr_in == NULL) && (hdr_in_len > 0)))
+    {
+        return(LL_IFC_ERROR_INCORRECT_PARAMETER);
+    }
     if (((buf_in  != NULL) && ( in_len == 0)) || (( buf_in == NULL) && ( in_len > 0)))
     {
         return(LL_IFC_ERROR_INCORRECT_PARAMETER);
     }
+    if (((hdr_out != NULL) && (hdr_out_len == 0)) || ((hdr_out == NULL) && (hdr_out_len > 0)))
+    {
+        return(LL_IFC_ERROR_INCORRECT_PARAMETER);
+    }
     if (((buf_out != NULL) && (out_len == 0)) || ((buf_out == NULL) && (out_len > 0)))
     {
         return(LL_IFC_ERROR_INCORRECT_PARAMETER);
     }
 
     // OK, inputs have been sanitized. Carry on...
-    send_packet(op, message_num, buf_in, in_len);
+    send_packet(op, message_num, hdr_in, hdr_in_len, buf_in, in_len);
 
-    ret = recv_packet(op, message_num, buf_out, out_len);
+    ret = recv_packet(op, message_num, hdr_out, hdr_out_len, buf_out, out_len);
 
     message_num++;
 
     return(ret);
 }
 
+int32_t hal_read_write_pipelined(opcode_t op, uint8_t count,
+                                 uint8_t const buf_in[], uint16_t in_len,
+                                 uint8_t buf_out[], uint16_t out_len,
+                                 int32_t results[])
+{
+    uint8_t sent = 0;
+    uint8_t i;
+    int32_t ret = 0;
+
+    if ((count == 0) || (buf_in == NULL) || (in_len == 0) ||
+        (buf_out == NULL) || (out_len == 0) || (results == NULL))
+    {
+        return(LL_IFC_ERROR_INCORRECT_PARAMETER);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        while ((sent < count) && (sent < i + HAL_PIPELINE_DEPTH))
+        {
+            send_packet(op, (uint8_t)(message_num + sent), NULL, 0, buf_in + sent * in_len, in_len);
+            sent++;
+        }
+
+        results[i] = recv_packet(op, (uint8_t)(message_num + i), NULL, 0, buf_out + i * out_len, out_len);
+        if ((results[i] < 0) && (ret == 0))
+        {
+            ret = results[i];
+        }
+
+        // Nothing more is coming in time; the module gets no further commands
+        if (results[i] == LL_IFC_ERROR_HOST_INTERFACE_TIMEOUT)
+        {
+            while (++i < count)
+            {
+                results[i] = LL_IFC_ERROR_HOST_INTERFACE_TIMEOUT;
+            }
+            break;
+        }
+    }
+
+    message_num += sent;
+
+    return(ret);
+}
+
 int32_t hal_read_write_exact(opcode_t op, uint8_t buf_in[], uint16_t in_len, uint8_t buf_out[], uint16_t out_len)
 {
     int32_t ret = hal_read_write(op, buf_in, in_len, buf_out, out_len);
@@ -449,6 +506,12 @@ int32_t ll_reset_state( void )
  * @param[in] message_num
  *   message_num
  *
+ * @param[in] hdr
+ *   optional leading part of the payload, sent ahead of buf
+ *
+ * @param[in] hdr_len
+ *   size of hdr in bytes
+ *
  * @param[in] buf
  *   byte array containing the data payload to be sent to the module
  *
@@ -458,7 +521,7 @@ int32_t ll_reset_state( void )
  * @return
  *   none
  */
-static void send_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint16_t len)
+static void send_packet(opcode_t op, uint8_t message_num, uint8_t const *hdr, uint16_t hdr_len, uint8_t const *buf, uint16_t len)
 {
     #define SP_NUM_ZEROS (4)
     #define SP_HEADER_SIZE (CMD_HEADER_LEN + SP_NUM_ZEROS)
@@ -466,6 +529,7 @@ static void send_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint16_t
     uint8_t checksum_buff[2];
     uint16_t computed_checksum;
     uint16_t header_idx = 0;
+    uint16_t payload_len = hdr_len + len;
     uint16_t i;
 
     // Send a couple wakeup bytes, just-in-case
@@ -477,16 +541,23 @@ static void send_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint16_t
     header_buf[header_idx++] = FRAME_START;
     header_buf[header_idx++] = op;
     header_buf[header_idx++] = message_num;
-    header_buf[header_idx++] = (uint8_t)(0xFF & (len >> 8));
-    header_buf[header_idx++] = (uint8_t)(0xFF & (len >> 0));
+    header_buf[header_idx++] = (uint8_t)(0xFF & (payload_len >> 8));
+    header_buf[header_idx++] = (uint8_t)(0xFF & (payload_len >> 0));
 
-    computed_checksum = compute_checksum(header_buf + SP_NUM_ZEROS, CMD_HEADER_LEN, buf, len);
+    computed_checksum = checksum_update(0, header_buf + SP_NUM_ZEROS, CMD_HEADER_LEN);
+    computed_checksum = checksum_update(computed_checksum, hdr, hdr_len);
+    computed_checksum = checksum_update(computed_checksum, buf, len);
 
     transport_write(header_buf, SP_HEADER_SIZE);
 
+    // Both parts go straight from the caller's memory
+    if (hdr != NULL)
+    {
+        transport_write((uint8_t *) hdr, hdr_len);
+    }
     if (buf != NULL)
     {
-        transport_write(buf, len);
+        transport_write((uint8_t *) buf, len);
     }
 
     checksum_buff[0] = (computed_checksum >> 8);
@@ -505,14 +576,20 @@ static void send_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint16_t
  * @param[in] message_num
  *   message number of the command that we're trying to receive
  *
- * @param[in] buf
+ * @param[out] hdr
+ *   optional byte array receiving the first hdr_len bytes of the payload
+ *
+ * @param[in] hdr_len
+ *   size of hdr in bytes
+ *
+ * @param[out] buf
  *   byte array for storing data returned from the module
  *
  * @param[in] len
  *   size of the output buffer in bytes
  *
  * @return
- *   positive number of bytes returned,
+ *   positive number of bytes returned in hdr and buf together,
  *   negative if an error
  *   Error Codes:
  *       -1 NACK received - Command not supported
@@ -532,10 +609,12 @@ static void send_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint16_t
  *     -108 transport_read failed getting FRAME_START
  *     -109 transport_read failed getting header
  */
-static int32_t recv_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint16_t len)
+static int32_t recv_packet(opcode_t op, uint8_t message_num, uint8_t *hdr, uint16_t hdr_len, uint8_t *buf, uint16_t len)
 {
     uint8_t  header_buf[RESP_HEADER_LEN];
     uint16_t header_idx;
+    uint16_t hdr_read = 0;
+    uint16_t buf_read = 0;
 
     uint8_t curr_byte = 0;
     uint8_t checksum_buff[2];
@@ -548,34 +627,59 @@ static int32_t recv_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint1
    // clock_t max_clock = (clock_t) (1.5 * (float)CLOCKS_PER_SEC);
  //   clock_t t = clock();
 
-    do
+    uint16_t len_from_header;
+    uint8_t behind;
+
+    for (;;)
     {
-        /* Timeout of infinite Rx loop if responses never show up*/
-        ret = transport_read(&curr_byte, 1);
-        if(ret<0)
+        do
         {
-            len = 0;
-            return LL_IFC_ERROR_HOST_INTERFACE_TIMEOUT;
+            /* Timeout of infinite Rx loop if responses never show up*/
+            ret = transport_read(&curr_byte, 1);
+            if(ret<0)
+            {
+                len = 0;
+                return LL_IFC_ERROR_HOST_INTERFACE_TIMEOUT;
+            }
+        } while(curr_byte != FRAME_START);
+
+        if (ret < 0)
+        {
+            /* transport_read failed - return an error */
+            return LL_IFC_ERROR_START_OF_FRAME;
         }
-    } while(curr_byte != FRAME_START);
 
-    if (ret < 0)
-    {
-        /* transport_read failed - return an error */
-        return LL_IFC_ERROR_START_OF_FRAME;
-    }
+        header_idx = 0;
+        header_buf[header_idx++] = FRAME_START;
 
-    header_idx = 0;
-    header_buf[header_idx++] = FRAME_START;
+        ret = transport_read(header_buf + 1, RESP_HEADER_LEN - 1);
+        if (ret < 0)
+        {
+            /* transport_read failed - return an error */
+            return LL_IFC_ERROR_HEADER;
+        }
 
-    ret = transport_read(header_buf + 1, RESP_HEADER_LEN - 1);
-    if (ret < 0)
-    {
-        /* transport_read failed - return an error */
-        return LL_IFC_ERROR_HEADER;
-    }
+        len_from_header = (uint16_t)header_buf[5] + ((uint16_t)header_buf[4] << 8);
 
-    uint16_t len_from_header = (uint16_t)header_buf[5] + ((uint16_t)header_buf[4] << 8);
+        // A reply arriving after its command timed out, up to a pipeline's
+        // worth of message numbers behind, is discarded with its checksum so
+        // the expected one is read next
+        behind = (uint8_t)(message_num - header_buf[2]);
+        if ((behind == 0) || (behind > HAL_PIPELINE_DEPTH))
+        {
+            break;
+        }
+        uint32_t remaining = (uint32_t) len_from_header + 2;
+        uint8_t temp_byte;
+        while (remaining > 0)
+        {
+            if (transport_read(&temp_byte, 1) < 0)
+            {
+                return LL_IFC_ERROR_HOST_INTERFACE_TIMEOUT;
+            }
+            remaining--;
+        }
+    }
 
     if (header_buf[1] != op)
     {
@@ -593,24 +697,30 @@ static int32_t recv_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint1
         // Map NACK code to error code
         ret_value = 0 - header_buf[3];
     }
-    if (len_from_header > len)
+    if (len_from_header > hdr_len + len)
     {
         // response is larger than the caller expects.
-        // Pull the bytes out of the Rx fifo
-        int32_t ret;
-        do
+        // hdr is still filled so the caller can tell what it missed (the
+        // checksum can't vouch for it); the rest of the payload and the
+        // checksum are pulled out of the Rx fifo so the next response
+        // starts on a frame boundary
+        uint32_t remaining = (uint32_t) len_from_header + 2;
+        uint8_t temp_byte;
+        if ((ret_value == 0) && (hdr != NULL) && (transport_read(hdr, hdr_len) >= 0))
+        {
+            remaining -= hdr_len;
+        }
+        while ((remaining > 0) && (transport_read(&temp_byte, 1) >= 0))
         {
-            uint8_t temp_byte;
-            ret = transport_read(&temp_byte, 1);
+            remaining--;
         }
-        while (ret == 0);
         return LL_IFC_ERROR_BUFFER_TOO_SMALL;
     }
-    else if (len_from_header < len)
-    {
-        // response is shorter than caller expects.
-        len = len_from_header;
-    }
+
+    // Split the payload between hdr and buf.  A response shorter than the
+    // caller expects fills hdr first.
+    hdr_read = (len_from_header < hdr_len) ? len_from_header : hdr_len;
+    buf_read = len_from_header - hdr_read;
 
     if (ret_value == 0)
     {
@@ -623,16 +733,27 @@ static int32_t recv_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint1
         //      allocated for the payload
 
         // Grab the payload if there is supposed to be one
-        if ((buf != NULL) && (len > 0))
+        if ((hdr != NULL) && (hdr_read > 0))
+        {
+            transport_read(hdr, hdr_read);
+        }
+        if ((buf != NULL) && (buf_read > 0))
         {
-            transport_read(buf, len);
+            transport_read(buf, buf_read);
         }
     }
+    else
+    {
+        hdr_read = 0;
+        buf_read = 0;
+    }
 
     // Finally, make sure the checksum matches
     transport_read(checksum_buff, 2);
 
-    computed_checksum = compute_checksum(header_buf, RESP_HEADER_LEN, buf, len);
+    computed_checksum = checksum_update(0, header_buf, RESP_HEADER_LEN);
+    computed_checksum = checksum_update(computed_checksum, hdr, hdr_read);
+    computed_checksum = checksum_update(computed_checksum, buf, buf_read);
     if (((uint16_t)checksum_buff[0] << 8) + checksum_buff[1] != computed_checksum)
     {
         return LL_IFC_ERROR_CHECKSUM_MISMATCH;
@@ -641,7 +762,7 @@ static int32_t recv_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint1
     if (ret_value == 0)
     {
         // Success! Return the number of bytes in the payload (0 or positive number)
-        return len;
+        return hdr_read + buf_read;
     }
     else
     {
@@ -652,41 +773,28 @@ static int32_t recv_packet(opcode_t op, uint8_t message_num, uint8_t *buf, uint1
 
 /**
  * @brief
- *   compute_checksum
+ *   checksum_update
  *
- * @param[in] hdr
- *   header array to compute checksum on
+ * @param[in] crc
+ *   checksum so far, 0 to start
  *
- * @param[in] hdr_len
- *   size of the header array in bytes
+ * @param[in] data
+ *   array to add to the checksum, may be NULL when len is 0
  *
- * @param[in] payload
- *   payload array to compute checksum on
- *
- * @param[in] payload_len
- *   size of the payload array in bytes
+ * @param[in] len
+ *   size of the array in bytes
  *
  * @return
- *   The 8-bit checksum
+ *   The updated 16-bit checksum
  */
-static uint16_t compute_checksum(uint8_t *hdr, uint16_t hdr_len, uint8_t *payload, uint16_t payload_len)
+static uint16_t checksum_update(uint16_t crc, uint8_t const *data, uint16_t len)
 {
-    uint16_t crc = 0x0;
     uint16_t i;
 
-    for (i = 0; i < hdr_len; i++)
-    {
-        crc  = (crc >> 8) | (crc << 8);
-        crc ^= hdr[i];
-        crc ^= (crc & 0xff) >> 4;
-        crc ^= crc << 12;
-        crc ^= (crc & 0xff) << 5;
-    }
-
-    for (i = 0; i < payload_len; i++)
+    for (i = 0; i < len; i++)
     {
         crc  = (crc >> 8) | (crc << 8);
-        crc ^= payload[i];
+        crc ^= data[i];
         crc ^= (crc & 0xff) >> 4;
         crc ^= crc << 12;
         crc ^= (crc & 0xff) << 5;
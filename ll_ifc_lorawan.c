@@ -1,10 +1,21 @@
 #include "ll_ifc_lorawan.h"
 #include "ll_ifc.h"
 #include "ll_ifc_private.h"
+#include <stdlib.h>  // rand
 
 
 #define LL_LORAWAN_ACTIVATE_TIMEOUT_S 60
 
+// Non-blocking join defaults, see ll_lorawan_join_t
+#define LL_LORAWAN_JOIN_ATTEMPT_TIMEOUT_MS  (LL_LORAWAN_ACTIVATE_TIMEOUT_S * 1000UL)
+#define LL_LORAWAN_JOIN_QUERY_INTERVAL_MS   (1000UL)
+#define LL_LORAWAN_JOIN_BACKOFF_BASE_MS     (10000UL)
+#define LL_LORAWAN_JOIN_BACKOFF_MAX_MS      (600000UL)
+#define LL_LORAWAN_JOIN_AIRTIME_MS          (1500UL)     // 23 byte join request at SF12/125kHz
+
+#define LL_LORAWAN_JOIN_FLAGS_TO_CLEAR      (IRQ_FLAGS_CONNECTED | IRQ_FLAGS_RX_DONE | \
+                                             IRQ_FLAGS_TX_ERROR | IRQ_FLAGS_TX_DONE)
+
 static uint32_t lorawan_active_wait()
 {
     uint8_t rsp[] = {0};
@@ -12,10 +23,6 @@ static uint32_t lorawan_active_wait()
     struct time time_start;
     struct time time_current;
     uint32_t irq_flags_read = 0;
-    static const uint32_t FLAGS_TO_CLEAR = IRQ_FLAGS_CONNECTED |
-                                           IRQ_FLAGS_RX_DONE |
-                                           IRQ_FLAGS_TX_ERROR |
-                                           IRQ_FLAGS_TX_DONE;
 
     gettime(&time_start);
 
@@ -34,7 +41,7 @@ static uint32_t lorawan_active_wait()
         switch (rsp[0])
         {
             case LL_LORAWAN_ACTIVATION_STATUS_COMPLETED: // unexpected but ok
-                ll_irq_flags(FLAGS_TO_CLEAR, &irq_flags_read);
+                ll_irq_flags(LL_LORAWAN_JOIN_FLAGS_TO_CLEAR, &irq_flags_read);
                 return 0;
             case LL_LORAWAN_ACTIVATION_STATUS_PENDING: // expected
                 break;
@@ -84,15 +91,14 @@ static int32_t lorawan_activate(uint8_t * msg, uint16_t msg_size)
 }
 
 
-int32_t ll_lorawan_activate_over_the_air(
+static int32_t lorawan_otaa_msg(
+        uint8_t * msg,
         enum ll_lorawan_network_type_e network_type,
         enum ll_lorawan_device_class_e device_class,
         uint8_t const * devEui,
         uint8_t const * appEui,
         uint8_t const * appKey)
 {
-    uint8_t msg[1 + 1 + 1 + 8 + 8 + 16];
-
     LL_ARG_CHECK((network_type == LL_LORAWAN_PUBLIC) || (network_type == LL_LORAWAN_PRIVATE));
     LL_ARG_CHECK((device_class == LL_LORAWAN_CLASS_A) ||
                  (device_class == LL_LORAWAN_CLASS_B) ||
@@ -107,6 +113,23 @@ int32_t ll_lorawan_activate_over_the_air(
     memcpy(&msg[3], devEui, 8);
     memcpy(&msg[3 + 8], appEui, 8);
     memcpy(&msg[3 + 8 + 8], appKey, 16);
+    return 0;
+}
+
+int32_t ll_lorawan_activate_over_the_air(
+        enum ll_lorawan_network_type_e network_type,
+        enum ll_lorawan_device_class_e device_class,
+        uint8_t const * devEui,
+        uint8_t const * appEui,
+        uint8_t const * appKey)
+{
+    uint8_t msg[1 + 1 + 1 + 8 + 8 + 16];
+
+    int32_t ret = lorawan_otaa_msg(msg, network_type, device_class, devEui, appEui, appKey);
+    if (ret < 0)
+    {
+        return ret;
+    }
 
     return lorawan_activate(msg, sizeof(msg));
 }
@@ -141,6 +164,245 @@ int32_t ll_lorawan_activate_personalization(
     return lorawan_activate(msg, sizeof(msg));
 }
 
+static int32_t lorawan_activation_status(uint8_t * msg, uint16_t msg_size, uint8_t * status)
+{
+    int32_t rw_response = hal_read_write(OP_LORAWAN_ACTIVATE, msg, msg_size, status, 1);
+    if (rw_response < 0)
+    {
+        return((int8_t) rw_response);
+    }
+    if (rw_response != 1)
+    {
+        return LL_IFC_ERROR_INCORRECT_MESSAGE_SIZE;
+    }
+    return 0;
+}
+
+static int32_t lorawan_join_elapsed(uint32_t now_ms, uint32_t since_ms)
+{
+    return (int32_t)(now_ms - since_ms);
+}
+
+static void lorawan_join_done(ll_lorawan_join_t * join)
+{
+    uint32_t irq_flags_read = 0;
+
+    ll_irq_flags(LL_LORAWAN_JOIN_FLAGS_TO_CLEAR, &irq_flags_read);
+    join->state = LL_LORAWAN_JOIN_JOINED;
+}
+
+static void lorawan_join_failed(ll_lorawan_join_t * join, uint32_t now_ms)
+{
+    uint32_t delay = join->backoff_base_ms;
+    uint32_t spacing = 0;
+    uint32_t running = (uint32_t) lorawan_join_elapsed(now_ms, join->start_ms);
+    uint8_t i;
+
+    if ((join->max_attempts != 0) && (join->attempts >= join->max_attempts))
+    {
+        join->state = LL_LORAWAN_JOIN_FAILED;
+        return;
+    }
+
+    // Exponential backoff with equal jitter
+    for (i = 1; (i < join->attempts) && (delay < join->backoff_max_ms); i++)
+    {
+        delay <<= 1;
+    }
+    if (delay > join->backoff_max_ms)
+    {
+        delay = join->backoff_max_ms;
+    }
+    delay = (delay / 2) + (uint32_t)(((uint64_t)(delay / 2) * (rand() & 0x7FFF)) >> 15);
+
+    // Join duty cycle limits, counted from the start of the failed attempt
+    if (running < 3600000UL)
+    {
+        spacing = join->join_airtime_ms * 100;
+    }
+    else if (running < 11 * 3600000UL)
+    {
+        spacing = join->join_airtime_ms * 1000;
+    }
+    else
+    {
+        spacing = join->join_airtime_ms * 10000;
+    }
+    running = (uint32_t) lorawan_join_elapsed(now_ms, join->attempt_ms);
+    if ((spacing > running) && (delay < spacing - running))
+    {
+        delay = spacing - running;
+    }
+
+    join->state = LL_LORAWAN_JOIN_BACKOFF;
+    join->next_ms = now_ms + delay;
+}
+
+static int32_t lorawan_join_attempt(ll_lorawan_join_t * join, uint32_t now_ms)
+{
+    uint8_t status;
+
+    int32_t ret = lorawan_activation_status(join->msg, sizeof(join->msg), &status);
+    if (ret < 0)
+    {
+        join->last_error = ret;
+        join->next_ms = now_ms + join->query_interval_ms;
+        return ret;
+    }
+
+    join->attempts++;
+    join->attempt_ms = now_ms;
+    join->next_ms = now_ms + join->query_interval_ms;
+    join->state = LL_LORAWAN_JOIN_PENDING;
+
+    switch (status)
+    {
+        case LL_LORAWAN_ACTIVATION_STATUS_COMPLETED: // unexpected but ok
+            lorawan_join_done(join);
+            break;
+        case LL_LORAWAN_ACTIVATION_STATUS_PENDING: // expected
+            break;
+        default:
+            lorawan_join_failed(join, now_ms);
+            break;
+    }
+    return join->state;
+}
+
+void ll_lorawan_join_init(ll_lorawan_join_t * join)
+{
+    memset(join, 0, sizeof(*join));
+    join->attempt_timeout_ms = LL_LORAWAN_JOIN_ATTEMPT_TIMEOUT_MS;
+    join->query_interval_ms = LL_LORAWAN_JOIN_QUERY_INTERVAL_MS;
+    join->backoff_base_ms = LL_LORAWAN_JOIN_BACKOFF_BASE_MS;
+    join->backoff_max_ms = LL_LORAWAN_JOIN_BACKOFF_MAX_MS;
+    join->join_airtime_ms = LL_LORAWAN_JOIN_AIRTIME_MS;
+    join->state = LL_LORAWAN_JOIN_IDLE;
+}
+
+int32_t ll_lorawan_join_start(
+        ll_lorawan_join_t * join,
+        enum ll_lorawan_network_type_e network_type,
+        enum ll_lorawan_device_class_e device_class,
+        uint8_t const * devEui,
+        uint8_t const * appEui,
+        uint8_t const * appKey,
+        uint32_t now_ms)
+{
+    uint32_t irq_flags_read = 0;
+    int32_t ret;
+
+    LL_ARG_CHECK(NULL != join);
+
+    ret = lorawan_otaa_msg(join->msg, network_type, device_class, devEui, appEui, appKey);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    // A stale flag from an earlier connection must not end this join
+    ret = ll_irq_flags(IRQ_FLAGS_CONNECTED, &irq_flags_read);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    join->state = LL_LORAWAN_JOIN_IDLE;
+    join->attempts = 0;
+    join->last_error = 0;
+    join->start_ms = now_ms;
+    join->attempt_ms = now_ms;
+
+    ret = lorawan_join_attempt(join, now_ms);
+    return (ret < 0) ? ret : 0;
+}
+
+int32_t ll_lorawan_join_step(ll_lorawan_join_t * join, uint32_t now_ms)
+{
+    uint8_t query[] = {LL_LORAWAN_ACTIVATION_QUERY};
+    uint32_t irq_flags_read = 0;
+    uint8_t status;
+    int32_t ret;
+
+    LL_ARG_CHECK(NULL != join);
+
+    switch (join->state)
+    {
+        case LL_LORAWAN_JOIN_PENDING:
+            break;
+        case LL_LORAWAN_JOIN_BACKOFF:
+            if (lorawan_join_elapsed(now_ms, join->next_ms) < 0)
+            {
+                return join->state;
+            }
+            return lorawan_join_attempt(join, now_ms);
+        default:
+            return join->state;
+    }
+
+    // Connected shows up in the IRQ flags the moment it happens
+    ret = ll_irq_flags(0, &irq_flags_read);
+    if (ret < 0)
+    {
+        join->last_error = ret;
+        return ret;
+    }
+    if (irq_flags_read & IRQ_FLAGS_CONNECTED)
+    {
+        lorawan_join_done(join);
+        return join->state;
+    }
+
+    // Failure only shows up in the activation status
+    if (lorawan_join_elapsed(now_ms, join->next_ms) < 0)
+    {
+        return join->state;
+    }
+    join->next_ms = now_ms + join->query_interval_ms;
+
+    ret = lorawan_activation_status(query, sizeof(query), &status);
+    if (ret < 0)
+    {
+        join->last_error = ret;
+        return ret;
+    }
+
+    switch (status)
+    {
+        case LL_LORAWAN_ACTIVATION_STATUS_COMPLETED:
+            lorawan_join_done(join);
+            break;
+        case LL_LORAWAN_ACTIVATION_STATUS_PENDING:
+            if (lorawan_join_elapsed(now_ms, join->attempt_ms) > (int32_t) join->attempt_timeout_ms)
+            {
+                lorawan_join_failed(join, now_ms);
+            }
+            break;
+        default:
+            lorawan_join_failed(join, now_ms);
+            break;
+    }
+    return join->state;
+}
+
+enum ll_lorawan_join_state_e ll_lorawan_join_status(ll_lorawan_join_t const * join)
+{
+    return join->state;
+}
+
+uint32_t ll_lorawan_join_wait_ms(ll_lorawan_join_t const * join, uint32_t now_ms)
+{
+    int32_t remaining;
+
+    if ((join->state != LL_LORAWAN_JOIN_PENDING) && (join->state != LL_LORAWAN_JOIN_BACKOFF))
+    {
+        return UINT32_MAX;
+    }
+
+    remaining = (int32_t)(join->next_ms - now_ms);
+    return (remaining > 0) ? (uint32_t) remaining : 0;
+}
+
 int32_t ll_lorawan_param_get_i32(enum ll_lorawan_param_e param, int32_t * value)
 {
     uint8_t msg[1 + 1 + 1];
@@ -192,6 +454,126 @@ int32_t ll_lorawan_param_set_i32(enum ll_lorawan_param_e param, int32_t value)
     return 0;
 }
 
+int32_t ll_lorawan_param_get_multi(uint32_t params, int32_t * values, uint32_t * read)
+{
+    uint8_t msg[LL_LORAWAN_NUM_PARAMS][1 + 1 + 1];
+    uint8_t rsp[LL_LORAWAN_NUM_PARAMS][1 + 1 + 1 + 4];
+    int32_t results[LL_LORAWAN_NUM_PARAMS];
+    uint8_t param[LL_LORAWAN_NUM_PARAMS];
+    uint8_t const * p;
+    uint8_t count = 0;
+    uint8_t i;
+    int32_t ret = 0;
+
+    LL_ARG_CHECK((params != 0) && ((params & ~LL_LORAWAN_PARAMS_ALL) == 0));
+    LL_ARG_CHECK(NULL != values);
+
+    for (i = 0; i < LL_LORAWAN_NUM_PARAMS; i++)
+    {
+        if (params & LL_LORAWAN_PARAM_BIT(i))
+        {
+            msg[count][0] = 3;
+            msg[count][1] = i;
+            msg[count][2] = 0;
+            param[count++] = i;
+        }
+    }
+
+    hal_read_write_pipelined(OP_LORAWAN_PARAM, count, msg[0], sizeof(msg[0]),
+                             rsp[0], sizeof(rsp[0]), results);
+
+    if (read != NULL)
+    {
+        *read = 0;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if ((results[i] >= 0) && (results[i] != sizeof(rsp[0])))
+        {
+            results[i] = LL_IFC_ERROR_INCORRECT_MESSAGE_SIZE;
+        }
+        if (results[i] < 0)
+        {
+            if (ret == 0)
+            {
+                ret = (int8_t) results[i];
+            }
+            continue;
+        }
+
+        p = rsp[i] + 3;
+        values[param[i]] = (int32_t) read_uint32(&p);
+        if (read != NULL)
+        {
+            *read |= LL_LORAWAN_PARAM_BIT(param[i]);
+        }
+    }
+    return ret;
+}
+
+void ll_lorawan_param_cache_init(ll_lorawan_param_cache_t * cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+void ll_lorawan_param_cache_invalidate(ll_lorawan_param_cache_t * cache, uint32_t params)
+{
+    cache->valid &= ~params;
+}
+
+int32_t ll_lorawan_param_cache_refresh(ll_lorawan_param_cache_t * cache, uint32_t params,
+                                       uint32_t max_age_ms, uint32_t now_ms)
+{
+    uint32_t stale = 0;
+    uint32_t read = 0;
+    uint8_t i;
+    int32_t ret;
+
+    LL_ARG_CHECK(NULL != cache);
+
+    for (i = 0; i < LL_LORAWAN_NUM_PARAMS; i++)
+    {
+        if ((params & LL_LORAWAN_PARAM_BIT(i)) &&
+            (!(cache->valid & LL_LORAWAN_PARAM_BIT(i)) || (max_age_ms == 0) ||
+             ((now_ms - cache->read_ms[i]) > max_age_ms)))
+        {
+            stale |= LL_LORAWAN_PARAM_BIT(i);
+        }
+    }
+    if (stale == 0)
+    {
+        return 0;
+    }
+
+    ret = ll_lorawan_param_get_multi(stale, cache->value, &read);
+    for (i = 0; i < LL_LORAWAN_NUM_PARAMS; i++)
+    {
+        if (read & LL_LORAWAN_PARAM_BIT(i))
+        {
+            cache->read_ms[i] = now_ms;
+        }
+    }
+    cache->valid |= read;
+    return ret;
+}
+
+int32_t ll_lorawan_param_cache_get(ll_lorawan_param_cache_t * cache, enum ll_lorawan_param_e param,
+                                   uint32_t max_age_ms, uint32_t now_ms, int32_t * value)
+{
+    int32_t ret;
+
+    LL_ARG_CHECK((param >= 0) && (param < LL_LORAWAN_NUM_PARAMS));
+    LL_ARG_CHECK(NULL != value);
+
+    ret = ll_lorawan_param_cache_refresh(cache, LL_LORAWAN_PARAM_BIT(param), max_age_ms, now_ms);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    *value = cache->value[param];
+    return 0;
+}
+
 static int32_t ll_lorawan_send_internal(
         uint8_t flags,
         uint8_t fPort,
@@ -199,7 +581,7 @@ static int32_t ll_lorawan_send_internal(
         uint8_t buffer_length,
         uint8_t retries)
 {
-    uint8_t msg[1 + 1 + 1 + 1 + 256];
+    uint8_t msg[1 + 1 + 1 + 1];
     uint8_t rsp[] = {0};
 
     LL_ARG_CHECK(fPort > 0);
@@ -210,9 +592,10 @@ static int32_t ll_lorawan_send_internal(
     msg[1] = fPort;
     msg[2] = retries;
     msg[3] = buffer_length;
-    memcpy(msg + 4, buffer, buffer_length);
 
-    int32_t rw_response = hal_read_write(OP_LORAWAN_MSG_SEND, msg, 4 + buffer_length, rsp, sizeof(rsp));
+    // The payload is streamed from the caller's buffer behind the header
+    int32_t rw_response = hal_read_write_sg(OP_LORAWAN_MSG_SEND, msg, sizeof(msg), buffer, buffer_length,
+                                            rsp, sizeof(rsp), NULL, 0);
     if (rw_response < 0)
     {
         return rw_response;
@@ -241,19 +624,23 @@ int32_t ll_lorawan_send_confirmed(
 
 int32_t ll_lorawan_receive(uint8_t * buf, uint16_t len, ll_lorawan_rx_t * rx)
 {
-    uint8_t msg[256];
+    uint8_t msg[8] = {0};
 
     LL_ARG_CHECK(NULL != buf);
     LL_ARG_CHECK(len > 0);
     LL_ARG_CHECK(NULL != rx);
 
-    int32_t rw_response = hal_read_write(OP_LORAWAN_MSG_RECEIVE, 0, 0, msg, sizeof(msg));
-    if (rw_response < 0)
+    // The metadata is parsed in place, the data lands straight in buf.  A
+    // message longer than len is drained and reported as too small, with
+    // the metadata still filled in if it could be read, and all zero (no
+    // flags) if not.
+    int32_t rw_response = hal_read_write_sg(OP_LORAWAN_MSG_RECEIVE, NULL, 0, NULL, 0, msg, sizeof(msg), buf, len);
+    if ((rw_response < 0) && (rw_response != LL_IFC_ERROR_BUFFER_TOO_SMALL))
     {
         return((int8_t) rw_response);
     }
 
-    if (rw_response < 8)
+    if ((rw_response >= 0) && (rw_response < 8))
     {
         return LL_IFC_ERROR_INCORRECT_MESSAGE_SIZE;
     }
@@ -267,17 +654,15 @@ int32_t ll_lorawan_receive(uint8_t * buf, uint16_t len, ll_lorawan_rx_t * rx)
     rx->RxPort = msg[6];
     rx->bytes_received = msg[7];
 
-    if (rw_response != (8 + rx->bytes_received))
+    if (rw_response < 0)
     {
-        return LL_IFC_ERROR_INCORRECT_MESSAGE_SIZE;
+        return rw_response;
     }
 
-    if (rx->bytes_received > len)
+    if (rw_response != (8 + rx->bytes_received))
     {
-        return LL_IFC_ERROR_BUFFER_TOO_SMALL;
+        return LL_IFC_ERROR_INCORRECT_MESSAGE_SIZE;
     }
 
-    memcpy(buf, &msg[8], rx->bytes_received);
-
     return 0;
 }
@@ -165,6 +165,128 @@ extern "C" {
             uint8_t const * netSKey,
             uint8_t const * appSKey );
 
+    /**
+     * @brief
+     *   The state of a non-blocking over-the-air join.
+     */
+    typedef enum ll_lorawan_join_state_e {
+        /** Not started. */
+        LL_LORAWAN_JOIN_IDLE = 0,
+
+        /** A join request is outstanding. */
+        LL_LORAWAN_JOIN_PENDING,
+
+        /** The last attempt failed, waiting before the next one. */
+        LL_LORAWAN_JOIN_BACKOFF,
+
+        /** The module is connected. */
+        LL_LORAWAN_JOIN_JOINED,
+
+        /** The attempt limit was reached. */
+        LL_LORAWAN_JOIN_FAILED
+    } ll_lorawan_join_state_t;
+
+    /**
+     * @brief
+     *   The non-blocking over-the-air join context.
+     *
+     * @details
+     *   Initialize with ll_lorawan_join_init().  The retry policy fields may
+     *   be changed before ll_lorawan_join_start().  All times are in
+     *   milliseconds of a free running host clock supplied by the caller.
+     *
+     *   A failed attempt is retried after an exponential backoff with random
+     *   jitter, from backoff_base_ms doubling up to backoff_max_ms.  The
+     *   LoRaWAN join duty cycle (1% during the first hour after start, 0.1%
+     *   for the next ten hours, 0.01% after that) is enforced as a minimum
+     *   spacing between attempts derived from join_airtime_ms, the time on
+     *   air of one join request.  Set it to 0 to skip this.
+     */
+    typedef struct ll_lorawan_join_s {
+        uint32_t attempt_timeout_ms;    /**< give up on one attempt after this long */
+        uint32_t query_interval_ms;     /**< activation status query spacing */
+        uint32_t backoff_base_ms;
+        uint32_t backoff_max_ms;
+        uint32_t join_airtime_ms;
+        uint8_t max_attempts;           /**< 0 retries forever */
+
+        enum ll_lorawan_join_state_e state;
+        uint8_t attempts;
+        int32_t last_error;             /**< last host interface error, 0 if none */
+        uint32_t start_ms;              /**< first attempt */
+        uint32_t attempt_ms;            /**< current attempt */
+        uint32_t next_ms;               /**< next query or next attempt */
+        uint8_t msg[1 + 1 + 1 + 8 + 8 + 16];
+    } ll_lorawan_join_t;
+
+    /**
+     * @brief
+     *   Initialize a join context with the default retry policy.
+     *
+     * @param[out] join
+     *   The join context.
+     */
+    void ll_lorawan_join_init(ll_lorawan_join_t * join);
+
+    /**
+     * @brief
+     *   Start a non-blocking over-the-air join.
+     *
+     * @details
+     *   Sends the first join request and returns without waiting for the
+     *   result.  Call ll_lorawan_join_step() to advance the join.  The
+     *   parameters are those of ll_lorawan_activate_over_the_air().
+     *
+     * @param[in] now_ms
+     *   The current host time.
+     *
+     * @return
+     *   0 - success, negative otherwise.
+     */
+    int32_t ll_lorawan_join_start(
+            ll_lorawan_join_t * join,
+            enum ll_lorawan_network_type_e network_type,
+            enum ll_lorawan_device_class_e device_class,
+            uint8_t const * devEui,
+            uint8_t const * appEui,
+            uint8_t const * appKey,
+            uint32_t now_ms);
+
+    /**
+     * @brief
+     *   Advance a join without blocking.
+     *
+     * @details
+     *   Completion is detected from IRQ_FLAGS_CONNECTED on every call, so
+     *   calling this when the module raises its IRQ line reports the join
+     *   as soon as it happens.  A failed attempt is detected with an
+     *   activation query at most every query_interval_ms.  A host interface
+     *   error leaves the state unchanged, the step can simply be repeated.
+     *
+     * @param[in] now_ms
+     *   The current host time.
+     *
+     * @return
+     *   The ::ll_lorawan_join_state_e, or a negative error code value.
+     */
+    int32_t ll_lorawan_join_step(ll_lorawan_join_t * join, uint32_t now_ms);
+
+    /**
+     * @brief
+     *   Get the state of a join.
+     */
+    enum ll_lorawan_join_state_e ll_lorawan_join_status(ll_lorawan_join_t const * join);
+
+    /**
+     * @brief
+     *   Get the time until the join next needs a step without an IRQ.
+     *
+     * @return
+     *   Milliseconds, 0 if a step is due now, UINT32_MAX when no join is
+     *   in progress.
+     */
+    uint32_t ll_lorawan_join_wait_ms(ll_lorawan_join_t const * join, uint32_t now_ms);
+
     /**
      * @brief
      *   Get a LoRaWAN parameter value.
@@ -195,6 +317,98 @@ extern "C" {
      */
     int32_t ll_lorawan_param_set_i32(enum ll_lorawan_param_e param, int32_t value);
 
+    /** The number of ::ll_lorawan_param_e parameters. */
+    #define LL_LORAWAN_NUM_PARAMS (LL_LORAWAN_PARAM_DOWNLINK_COUNTER + 1)
+
+    /** The bit for a parameter in a parameter set. */
+    #define LL_LORAWAN_PARAM_BIT(param) (1UL << (param))
+
+    /** Every parameter. */
+    #define LL_LORAWAN_PARAMS_ALL (LL_LORAWAN_PARAM_BIT(LL_LORAWAN_NUM_PARAMS) - 1)
+
+    /**
+     * @brief
+     *   Get several LoRaWAN parameter values at once.
+     *
+     * @details
+     *   The requests are written back to back with
+     *   hal_read_write_pipelined() instead of one round trip each.
+     *
+     * @param[in] params
+     *   The set of parameters to get, LL_LORAWAN_PARAM_BIT() of each.
+     *
+     * @param[out] values
+     *   LL_LORAWAN_NUM_PARAMS values indexed by ::ll_lorawan_param_e.  Only
+     *   the entries of parameters that were read are written.
+     *
+     * @param[out] read
+     *   The set of parameters that were read, may be NULL.
+     *
+     * @return
+     *   0 if all were read, otherwise the first negative error code value.
+     */
+    int32_t ll_lorawan_param_get_multi(uint32_t params, int32_t * values, uint32_t * read);
+
+    /**
+     * @brief
+     *   Cached LoRaWAN parameter values.
+     *
+     * @details
+     *   Initialize with ll_lorawan_param_cache_init().  Each value remembers
+     *   when it was read, so a caller states how old a value it accepts and
+     *   only the parameters older than that are read again, all in one
+     *   ll_lorawan_param_get_multi().  Values that change with traffic, such
+     *   as the frame counters, are best invalidated when the module reports
+     *   that traffic.
+     */
+    typedef struct ll_lorawan_param_cache_s {
+        int32_t value[LL_LORAWAN_NUM_PARAMS];
+        uint32_t read_ms[LL_LORAWAN_NUM_PARAMS];   /**< host time of each read */
+        uint32_t valid;                             /**< set of parameters read */
+    } ll_lorawan_param_cache_t;
+
+    /**
+     * @brief
+     *   Initialize a parameter cache, with nothing in it.
+     */
+    void ll_lorawan_param_cache_init(ll_lorawan_param_cache_t * cache);
+
+    /**
+     * @brief
+     *   Forget a set of parameters.
+     */
+    void ll_lorawan_param_cache_invalidate(ll_lorawan_param_cache_t * cache, uint32_t params);
+
+    /**
+     * @brief
+     *   Bring a set of parameters up to date.
+     *
+     * @param[in] params
+     *   The set of parameters, LL_LORAWAN_PARAM_BIT() of each.
+     *
+     * @param[in] max_age_ms
+     *   Values read at most this long ago are kept, 0 reads all of them.
+     *
+     * @param[in] now_ms
+     *   The current host time.
+     *
+     * @return
+     *   0 if all of them are valid, otherwise the first negative error code
+     *   value.  Those that were read are updated either way.
+     */
+    int32_t ll_lorawan_param_cache_refresh(ll_lorawan_param_cache_t * cache, uint32_t params,
+                                           uint32_t max_age_ms, uint32_t now_ms);
+
+    /**
+     * @brief
+     *   Get one parameter, read only when the cached value is too old.
+     *
+     * @return
+     *   0 on success or a negative error code value.
+     */
+    int32_t ll_lorawan_param_cache_get(ll_lorawan_param_cache_t * cache, enum ll_lorawan_param_e param,
+                                       uint32_t max_age_ms, uint32_t now_ms, int32_t * value);
+
     /**
      * @brief
      *   Send a packet over LoRaWAN.
@@ -299,7 +513,10 @@ extern "C" {
      *
      * @return
      *   0 on success or a negative error code value.  If no packet was
-     *   received, then RxBufferSize will be 0.
+     *   received, then RxBufferSize will be 0.  A packet longer than len is
+     *   lost and returns LL_IFC_ERROR_BUFFER_TOO_SMALL, but rx is still
+     *   filled in, so an ACK or link check answer it carried isn't.  If the
+     *   metadata couldn't be read either, rx is all zero (flags 0).
      */
     int32_t ll_lorawan_receive(uint8_t * buf, uint16_t len, ll_lorawan_rx_t * rx);
 
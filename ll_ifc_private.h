@@ -38,8 +38,56 @@ extern "C" {
  */
 int32_t hal_read_write(opcode_t op, uint8_t buf_in[], uint16_t in_len, uint8_t buf_out[], uint16_t out_len);
 
+/**
+ * @brief
+ *   Gather/scatter variant of hal_read_write().  The command payload is
+ *   hdr_in followed by buf_in, streamed to the transport without being
+ *   assembled first.  The response payload fills hdr_out and then buf_out,
+ *   so a fixed size response header can be parsed in place while the data
+ *   lands straight in the caller's buffer.  Either part may be NULL with a
+ *   zero length.
+ *
+ * @return
+ *   The total number of response bytes, or a negative error as for
+ *   hal_read_write().
+ */
+int32_t hal_read_write_sg(opcode_t op,
+                          uint8_t const hdr_in[], uint16_t hdr_in_len, uint8_t const buf_in[], uint16_t in_len,
+                          uint8_t hdr_out[], uint16_t hdr_out_len, uint8_t buf_out[], uint16_t out_len);
+
 int32_t hal_read_write_exact(opcode_t op, uint8_t buf_in[], uint16_t in_len, uint8_t buf_out[], uint16_t out_len);
 
+/**
+ * @brief
+ *   Commands kept in flight by hal_read_write_pipelined() ahead of the
+ *   response being read.
+ */
+#ifndef HAL_PIPELINE_DEPTH
+#define HAL_PIPELINE_DEPTH (4)
+#endif
+
+/**
+ * @brief
+ *   Issue count commands with the same opcode back to back.
+ *
+ * @details
+ *   Command i is in_len bytes at buf_in + i * in_len and its response is
+ *   read into buf_out + i * out_len.  Up to HAL_PIPELINE_DEPTH commands are
+ *   written before the first response is read, so the module works on the
+ *   next one while the host reads the previous answer.  results[i] is what
+ *   hal_read_write() would have returned for command i.  After a response
+ *   times out the remaining ones are not waited for and report the same
+ *   error; should their replies still arrive, the next command's read skips
+ *   them.
+ *
+ * @return
+ *   0 if every command succeeded, otherwise the first error.
+ */
+int32_t hal_read_write_pipelined(opcode_t op, uint8_t count,
+                                 uint8_t const buf_in[], uint16_t in_len,
+                                 uint8_t buf_out[], uint16_t out_len,
+                                 int32_t results[]);
+
 
 #ifdef __cplusplus
 }